@@ -0,0 +1,129 @@
+#include "Batch.h"
+#include "ProgramCache.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// Owner takes work from the front, thieves take from the back
+class WorkQueue
+{
+public:
+    void push(std::size_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(index);
+    }
+
+    bool pop(std::size_t& index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        index = items.front();
+        items.pop_front();
+        return true;
+    }
+
+    bool steal(std::size_t& index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        index = items.back();
+        items.pop_back();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<std::size_t> items;
+};
+
+BatchResult runOne(const BatchProgram& program, std::uint64_t maxSteps, std::size_t memorySize, Cpu::Engine engine)
+{
+    BatchResult result;
+    result.name = program.name;
+
+    Cpu cpu(engine, memorySize);
+    cpu.set_error_stream(nullptr); // reported through BatchResult::error
+    if (program.inMemory) {
+        std::istringstream in(program.source);
+        result.status = cpu.execute(in, maxSteps);
+    }
+    else {
+        // batches tend to repeat files, decode each one once per process
+        std::shared_ptr<const Program> decoded = ProgramCache::instance().load(program.name, memorySize, result.error);
+        if (decoded != nullptr) {
+            cpu.load(std::move(decoded));
+            result.status = cpu.run(maxSteps);
+        }
+    }
+
+    result.ok = result.status == Cpu::RunStatus::Halted;
+    if (cpu.failed()) {
+        result.error = cpu.error_message();
+    }
+    for (std::size_t i = 0; i < registerCount; ++i) {
+        result.registers[i] = cpu.read_register(static_cast<Register>(i));
+    }
+    result.memory.resize(cpu.memory_size());
+    for (std::size_t i = 0; i < result.memory.size(); ++i) {
+        result.memory[i] = cpu.read_memory(i);
+    }
+    return result;
+}
+
+}
+
+std::vector<BatchResult> runBatch(const std::vector<BatchProgram>& programs, unsigned threadCount, std::uint64_t maxSteps,
+    std::size_t memorySize, Cpu::Engine engine)
+{
+    std::vector<BatchResult> results(programs.size());
+    if (programs.empty()) {
+        return results;
+    }
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = static_cast<unsigned>(std::min<std::size_t>(threadCount, programs.size()));
+
+    // contiguous chunks keep neighbouring programs on one worker until someone runs dry
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (std::size_t i = 0; i < programs.size(); ++i) {
+        queues[i * threadCount / programs.size()]->push(i);
+    }
+
+    auto worker = [&](unsigned self) {
+        std::size_t index = 0;
+        for (;;) {
+            bool found = queues[self]->pop(index);
+            for (unsigned k = 1; !found && k < threadCount; ++k) {
+                found = queues[(self + k) % threadCount]->steal(index);
+            }
+            if (!found) {
+                return; // nothing is ever added after start, so empty everywhere means done
+            }
+            results[index] = runOne(programs[index], maxSteps, memorySize, engine);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
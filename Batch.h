@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include "Cpu.h"
+
+struct BatchProgram
+{
+	std::string name;      // file path, or any name for an in-memory program
+	std::string source;    // program text, used when inMemory is set
+	bool inMemory = false;
+};
+
+struct BatchResult
+{
+	std::string name;
+	bool ok = false;       // the program ran to completion
+	Cpu::RunStatus status = Cpu::RunStatus::Error;
+	std::string error;     // error reported by the Cpu when status is Error
+	std::array<int, registerCount> registers{};
+	std::vector<int> memory;
+};
+
+// Runs every program on its own Cpu of memorySize cells and the given engine over a work-stealing
+// pool of threadCount workers (0 = one per hardware thread). Results come back in input order.
+// A program still running after maxSteps instructions is stopped with BudgetExhausted.
+// Program files are decoded through ProgramCache, so repeating a file is only a stat.
+std::vector<BatchResult> runBatch(const std::vector<BatchProgram>& programs, unsigned threadCount = 0,
+	std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max(), std::size_t memorySize = Cpu::defaultMemorySize,
+	Cpu::Engine engine = Cpu::Engine::Threaded);
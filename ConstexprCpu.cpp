@@ -0,0 +1,63 @@
+// ConstexprCpu is header-only; this file has the compiler assemble and run a few
+// programs whenever cpu_core builds, so a change that breaks constant evaluation or
+// drifts from Cpu's results fails the build.
+#include "ConstexprCpu.h"
+
+namespace {
+
+constexpr int reg(const ConstexprCpu<32>::Result& result, Register r)
+{
+    return result.registers[static_cast<std::size_t>(r)];
+}
+
+// squares of 0..7 into memory, through a label, CMP and a fused CMP / JL
+constexpr auto squares = ConstexprCpu<32>::execute(
+    "MOV AYB , 0\n"
+    "loop: MOV BEN , AYB\n"
+    "MUL BEN , AYB\n"
+    "MOV [AYB+16] , BEN\n"
+    "ADD AYB , 1\n"
+    "CMP AYB , 8\n"
+    "JL loop\n");
+static_assert(squares.status == Cpu::RunStatus::Halted, "squares doesn't assemble or run");
+static_assert(squares.instructions == 7);
+static_assert(squares.retired == 1 + 8 * 6);
+static_assert(reg(squares, Register::AYB) == 8 && reg(squares, Register::BEN) == 49);
+static_assert(reg(squares, Register::DA) == 0);
+static_assert(squares.memory[16] == 0 && squares.memory[19] == 9 && squares.memory[23] == 49);
+static_assert(squares.memory[0] == 0); // cells holding instructions read as 0
+
+// wrapping arithmetic and the overflow flag
+constexpr auto wrapped = ConstexprCpu<32>::execute(
+    "MOV BEN , 2147483647\n"
+    "ADD BEN , 1\n"
+    "MOV GIM , ZA\n"
+    "NOT BEN\n");
+static_assert(wrapped.status == Cpu::RunStatus::Halted);
+static_assert(reg(wrapped, Register::GIM) == 1 && reg(wrapped, Register::BEN) == 2147483647);
+
+// single-core atomics: the old cell goes to AYB
+constexpr auto atomics = ConstexprCpu<32>::execute(
+    "MOV [20] , 4\n"
+    "MOV AYB , 4\n"
+    "CAS [20] , 9\n"
+    "FENCE\n"
+    "XADD [20] , 3\n");
+static_assert(atomics.status == Cpu::RunStatus::Halted);
+static_assert(atomics.memory[20] == 12 && reg(atomics, Register::AYB) == 9);
+
+// errors carry Cpu's message and the source line
+constexpr auto divideByZero = ConstexprCpu<32>::execute(
+    "MOV BEN , 1\n"
+    "DIV BEN , AYB\n");
+static_assert(divideByZero.status == Cpu::RunStatus::Error);
+static_assert(std::string_view(divideByZero.error) == "Can't divide by zero" && divideByZero.errorLine == 2);
+
+// GH moved past INT_MAX wraps and leaves the program, as in Cpu
+constexpr auto farJump = ConstexprCpu<32>::execute("MOV GH , 2147483647\n");
+static_assert(farJump.status == Cpu::RunStatus::Halted && reg(farJump, Register::GH) == -2147483647 - 1);
+
+constexpr auto budget = ConstexprCpu<32>::execute("loop: JMP loop\n", 100);
+static_assert(budget.status == Cpu::RunStatus::BudgetExhausted && budget.retired == 100);
+
+}
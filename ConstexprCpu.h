@@ -0,0 +1,498 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string_view>
+#include "Cpu.h"
+#include "Instruction.h"
+
+// Assembler and interpreter for the Cpu instruction set that run at compile time, for
+// fixed programs such as table generators that would otherwise go through
+// Cpu::execute at every startup:
+//
+//   constexpr auto squares = ConstexprCpu<64>::execute(
+//       "MOV AYB , 32\n"
+//       "loop: MOV BEN , AYB\n"
+//       ...);
+//   static_assert(squares.status == Cpu::RunStatus::Halted, "squares doesn't assemble or run");
+//   constexpr std::array<int, 64> table = squares.memory;
+//
+// Syntax, error messages and results are those of Cpu::execute on a Cpu of MemorySize
+// cells, retired count and budget included. Label errors leave out the label name, the
+// line points at it instead. Arithmetic wraps like the interpreters do on two's
+// complement hosts rather than overflowing, which would not be a constant expression.
+// Compilers bound constant evaluation (GCC: -fconstexpr-loop-limit, -fconstexpr-ops-limit),
+// long programs need those raised along with maxSteps.
+template <std::size_t MemorySize = Cpu::defaultMemorySize>
+class ConstexprCpu
+{
+	static_assert(MemorySize >= 1 && MemorySize <= Cpu::maxMemorySize, "memory size out of range, see Cpu::maxMemorySize");
+
+public:
+	static constexpr std::uint64_t defaultMaxSteps = 100000;
+
+	struct Result
+	{
+		Cpu::RunStatus status = Cpu::RunStatus::Error;
+		const char* error = nullptr;  // what Cpu::error_message would say, nullptr unless status is Error
+		std::size_t errorLine = 0;    // 1-based source line the error is about, 0 without error
+		std::size_t instructions = 0; // cells taken by instructions, left 0 in memory
+		std::uint64_t retired = 0;
+		std::array<int, registerCount> registers{};
+		std::array<int, MemorySize> memory{};
+	};
+
+	static constexpr Result execute(std::string_view source, std::uint64_t maxSteps = defaultMaxSteps);
+
+private:
+	constexpr ConstexprCpu() = default;
+
+	constexpr void load(std::string_view source);
+	constexpr void run(std::uint64_t maxSteps);
+	constexpr bool decode(std::string_view line, Instruction& inst);
+	constexpr bool decodeOperand(std::string_view token, Operand& operand) const;
+	constexpr bool checkAddress(int memAddress, std::size_t line);
+	constexpr bool indirectAddress(const Operand& operand, int& address, std::size_t line);
+	constexpr bool readOperand(const Operand& operand, int& value, std::size_t line);
+	constexpr bool writeOperand(const Operand& operand, int value, std::size_t line);
+	constexpr bool step(std::size_t address);
+	constexpr bool fused(std::size_t address) const;
+	constexpr void error(const char* message, std::size_t line);
+
+	static constexpr bool isSpace(char c);
+	static constexpr std::string_view nextToken(std::string_view& rest);
+	static constexpr bool parseInt(std::string_view number, int& value);
+	static constexpr int wrap(long long value);
+
+private:
+	Result result;
+	std::array<Instruction, MemorySize> code{};
+	std::array<std::string_view, MemorySize> labels{}; // label of each instruction
+	std::array<bool, MemorySize> labelled{};
+	std::size_t instSize = 0;
+	std::uint64_t stepLimit = 0;
+};
+
+template <std::size_t MemorySize>
+constexpr typename ConstexprCpu<MemorySize>::Result ConstexprCpu<MemorySize>::execute(std::string_view source, std::uint64_t maxSteps)
+{
+	ConstexprCpu cpu;
+	cpu.load(source);
+	cpu.run(maxSteps);
+	return cpu.result;
+}
+
+template <std::size_t MemorySize>
+constexpr void ConstexprCpu<MemorySize>::load(std::string_view source)
+{
+	std::array<std::string_view, MemorySize> text{};
+
+	// first pass: one instruction per line (as std::getline splits them), labels collected
+	std::size_t position = 0;
+	while (position < source.size()) {
+		std::size_t end = source.find('\n', position);
+		std::string_view line = source.substr(position, end == std::string_view::npos ? std::string_view::npos : end - position);
+		position = end == std::string_view::npos ? source.size() : end + 1;
+		if (instSize >= MemorySize) {
+			error("Instructions exceed program memory", instSize + 1);
+			return;
+		}
+		std::string_view rest = line;
+		std::string_view label = nextToken(rest);
+		if (!label.empty() && label.back() == ':') {
+			label.remove_suffix(1);
+			for (std::size_t i = 0; i < instSize; ++i) {
+				if (labelled[i] && labels[i] == label) {
+					error("Label is defined more than once", instSize + 1);
+					return;
+				}
+			}
+			labels[instSize] = label;
+			labelled[instSize] = true;
+			line.remove_prefix(line.find(':') + 1);
+			while (!line.empty() && line.front() == ' ') {
+				line.remove_prefix(1);
+			}
+		}
+		text[instSize] = line;
+		++instSize;
+	}
+	result.instructions = instSize;
+
+	// second pass: decode, jump targets are resolved through the labels
+	for (std::size_t i = 0; i < instSize; ++i) {
+		if (!decode(text[i], code[i])) {
+			if (result.errorLine == 0) {
+				result.errorLine = i + 1;
+			}
+			return;
+		}
+	}
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::decode(std::string_view line, Instruction& inst)
+{
+	constexpr std::string_view opcodes[] = {
+		"MOV", "ADD", "SUB", "MUL", "DIV", "AND", "OR", "NOT", "CMP", "JMP", "JG", "JL", "JE", "CAS", "XADD", "FENCE"
+	};
+
+	std::string_view rest = line;
+	std::string_view operation = nextToken(rest);
+	std::size_t opcode = 0;
+	while (opcode < std::size(opcodes) && opcodes[opcode] != operation) {
+		++opcode;
+	}
+	if (opcode == std::size(opcodes)) {
+		error("Incorrect instruction provided", 0);
+		return false;
+	}
+	inst.opcode = static_cast<Opcode>(opcode);
+
+	switch (inst.opcode) {
+	case Opcode::JMP:
+	case Opcode::JG:
+	case Opcode::JL:
+	case Opcode::JE: {
+		std::string_view label = nextToken(rest);
+		for (std::size_t i = 0; i < instSize; ++i) {
+			if (labelled[i] && labels[i] == label) {
+				inst.dst.kind = OperandKind::Label;
+				inst.dst.value = static_cast<int>(i);
+				return true;
+			}
+		}
+		error("Label is not defined", 0);
+		return false;
+	}
+	case Opcode::NOT:
+		if (!decodeOperand(nextToken(rest), inst.dst) || inst.dst.kind == OperandKind::Immediate) {
+			error("Incorrect operand provided", 0);
+			return false;
+		}
+		return true;
+	case Opcode::FENCE:
+		return true;
+	default:
+		break;
+	}
+
+	std::string_view op1 = nextToken(rest);
+	std::string_view comma = nextToken(rest);
+	std::string_view op2 = nextToken(rest);
+	if (comma != "," || !decodeOperand(op1, inst.dst) || !decodeOperand(op2, inst.src)) {
+		error("Incorrect operands provided", 0);
+		return false;
+	}
+	if (inst.dst.kind == OperandKind::Immediate) {
+		error("Destination can't be an immediate value", 0);
+		return false;
+	}
+	bool dstMemory = inst.dst.kind == OperandKind::Memory || inst.dst.kind == OperandKind::Indirect;
+	bool srcMemory = inst.src.kind == OperandKind::Memory || inst.src.kind == OperandKind::Indirect;
+	if (dstMemory && srcMemory) {
+		error("Both operands can't be memory addresses", 0);
+		return false;
+	}
+	if ((inst.opcode == Opcode::MUL || inst.opcode == Opcode::DIV) && inst.dst.kind != OperandKind::Register) {
+		error("MUL and DIV work only with a register destination", 0);
+		return false;
+	}
+	if ((inst.opcode == Opcode::CAS || inst.opcode == Opcode::XADD) && !dstMemory) {
+		error("CAS and XADD work only with a memory destination", 0);
+		return false;
+	}
+	return (inst.dst.kind != OperandKind::Memory || checkAddress(inst.dst.value, 0))
+		&& (inst.src.kind != OperandKind::Memory || checkAddress(inst.src.value, 0));
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::decodeOperand(std::string_view token, Operand& operand) const
+{
+	if (token.empty()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < registerCount; ++i) {
+		if (token == registerNames[i]) {
+			operand.kind = OperandKind::Register;
+			operand.value = static_cast<int>(i);
+			return true;
+		}
+	}
+	std::string_view number = token;
+	operand.kind = OperandKind::Immediate;
+	if (token.size() >= 3 && token.front() == '[' && token.back() == ']') {
+		number = token.substr(1, token.size() - 2);
+		operand.kind = OperandKind::Memory;
+		// [REG], [REG+imm] or [REG-imm]
+		std::size_t sign = number.find_first_of("+-", 1);
+		std::string_view base = number.substr(0, sign);
+		for (std::size_t i = 0; i < registerCount; ++i) {
+			if (base == registerNames[i]) {
+				operand.kind = OperandKind::Indirect;
+				operand.base = static_cast<Register>(i);
+				number = sign == std::string_view::npos ? "0" : number.substr(number[sign] == '+' ? sign + 1 : sign);
+				break;
+			}
+		}
+	}
+	return parseInt(number, operand.value);
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::checkAddress(int memAddress, std::size_t line)
+{
+	if (memAddress < static_cast<int>(instSize)) {
+		error("The memory address you try to use is occupied by instructions", line);
+		return false;
+	}
+	else if (memAddress >= static_cast<int>(MemorySize)) {
+		error("The memory exceeds program memory", line);
+		return false;
+	}
+	return true;
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::indirectAddress(const Operand& operand, int& address, std::size_t line)
+{
+	long long target = static_cast<long long>(result.registers[static_cast<std::size_t>(operand.base)]) + operand.value;
+	long long limit = static_cast<long long>(MemorySize);
+	address = static_cast<int>(target < -1 ? -1 : target > limit ? limit : target);
+	return checkAddress(address, line);
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::readOperand(const Operand& operand, int& value, std::size_t line)
+{
+	switch (operand.kind) {
+	case OperandKind::Register:
+		value = result.registers[operand.value];
+		return true;
+	case OperandKind::Memory:
+		value = result.memory[operand.value];
+		return true;
+	case OperandKind::Indirect: {
+		int address = 0;
+		if (!indirectAddress(operand, address, line)) {
+			return false;
+		}
+		value = result.memory[address];
+		return true;
+	}
+	default:
+		value = operand.value;
+		return true;
+	}
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::writeOperand(const Operand& operand, int value, std::size_t line)
+{
+	switch (operand.kind) {
+	case OperandKind::Register:
+		result.registers[operand.value] = value;
+		return true;
+	case OperandKind::Memory:
+		result.memory[operand.value] = value;
+		return true;
+	default: {
+		int address = 0;
+		if (!indirectAddress(operand, address, line)) {
+			return false;
+		}
+		result.memory[address] = value;
+		return true;
+	}
+	}
+}
+
+// Cpu::fuse would turn the pair starting here into a superinstruction, which retires
+// as one dispatch of two instructions
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::fused(std::size_t address) const
+{
+	if (address + 1 >= instSize) {
+		return false;
+	}
+	const Instruction& first = code[address];
+	Opcode second = code[address + 1].opcode;
+	if (first.opcode == Opcode::CMP) {
+		return second == Opcode::JG || second == Opcode::JL || second == Opcode::JE;
+	}
+	return first.opcode == Opcode::MOV && second == Opcode::ADD
+		&& first.dst.kind == OperandKind::Register && first.src.kind == OperandKind::Immediate
+		&& first.dst.value != static_cast<int>(Register::GH);
+}
+
+template <std::size_t MemorySize>
+constexpr void ConstexprCpu<MemorySize>::run(std::uint64_t maxSteps)
+{
+	if (result.error != nullptr) {
+		return;
+	}
+	stepLimit = maxSteps > std::numeric_limits<std::uint64_t>::max() - result.retired
+		? std::numeric_limits<std::uint64_t>::max()
+		: result.retired + maxSteps;
+
+	int& gh = result.registers[static_cast<std::size_t>(Register::GH)];
+	while (static_cast<std::size_t>(gh) < instSize && result.retired < stepLimit) {
+		bool pair = fused(static_cast<std::size_t>(gh));
+		result.retired += pair ? 2 : 1;
+		if (!step(static_cast<std::size_t>(gh)) || (pair && !step(static_cast<std::size_t>(gh)))) {
+			return;
+		}
+	}
+	result.status = static_cast<std::size_t>(gh) < instSize ? Cpu::RunStatus::BudgetExhausted : Cpu::RunStatus::Halted;
+}
+
+// Executes the instruction at address and moves GH on
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::step(std::size_t address)
+{
+	const Instruction& inst = code[address];
+	std::size_t line = address + 1;
+	int& gh = result.registers[static_cast<std::size_t>(Register::GH)];
+	int& da = result.registers[static_cast<std::size_t>(Register::DA)];
+	bool jump = false;
+	switch (inst.opcode) {
+	case Opcode::JMP: jump = true; break;
+	case Opcode::JG: jump = da == 1; break;
+	case Opcode::JL: jump = da == -1; break;
+	case Opcode::JE: jump = da == 0; break;
+	case Opcode::FENCE: break; // a single core, nothing to order
+	case Opcode::CAS:
+	case Opcode::XADD: {
+		int value = 0;
+		int address = inst.dst.value;
+		if (!readOperand(inst.src, value, line)
+			|| (inst.dst.kind == OperandKind::Indirect && !indirectAddress(inst.dst, address, line))) {
+			return false;
+		}
+		int& ayb = result.registers[static_cast<std::size_t>(Register::AYB)];
+		int& cell = result.memory[static_cast<std::size_t>(address)];
+		int old = cell;
+		if (inst.opcode == Opcode::XADD) {
+			cell = wrap(static_cast<long long>(old) + value);
+		}
+		else if (old == ayb) {
+			cell = value;
+		}
+		ayb = old;
+		break;
+	}
+	default: {
+		int value1 = 0;
+		int value2 = 0;
+		if ((inst.opcode != Opcode::MOV && !readOperand(inst.dst, value1, line))
+			|| (inst.opcode != Opcode::NOT && !readOperand(inst.src, value2, line))) {
+			return false;
+		}
+		long long value = 0;
+		switch (inst.opcode) {
+		case Opcode::MOV: value = value2; break;
+		case Opcode::ADD: value = static_cast<long long>(value1) + value2; break;
+		case Opcode::SUB: value = static_cast<long long>(value1) - value2; break;
+		case Opcode::MUL: value = static_cast<long long>(value1) * value2; break;
+		case Opcode::DIV:
+			if (value2 == 0) {
+				error("Can't divide by zero", line);
+				return false;
+			}
+			value = static_cast<long long>(value1) / value2;
+			break;
+		case Opcode::AND: value = value1 & value2; break;
+		case Opcode::OR: value = value1 | value2; break;
+		case Opcode::NOT: value = ~value1; break;
+		default: {
+			// CMP
+			int difference = wrap(static_cast<long long>(value1) - value2);
+			da = difference < 0 ? -1 : difference > 0 ? 1 : 0;
+			++gh;
+			return true;
+		}
+		}
+		if (!writeOperand(inst.dst, wrap(value), line)) {
+			return false;
+		}
+		bool arithmetic = inst.opcode == Opcode::ADD || inst.opcode == Opcode::SUB
+			|| inst.opcode == Opcode::MUL || inst.opcode == Opcode::DIV;
+		if (arithmetic && !(inst.dst.kind == OperandKind::Register && inst.dst.value == static_cast<int>(Register::ZA))) {
+			result.registers[static_cast<std::size_t>(Register::ZA)] = value != wrap(value) ? 1 : 0; // overflow, as Cpu evaluates ZA
+		}
+		break;
+	}
+	}
+	gh = jump ? inst.dst.value : wrap(static_cast<long long>(gh) + 1); // GH may have been left at INT_MAX
+	return true;
+}
+
+template <std::size_t MemorySize>
+constexpr void ConstexprCpu<MemorySize>::error(const char* message, std::size_t line)
+{
+	result.status = Cpu::RunStatus::Error;
+	result.error = message;
+	result.errorLine = line;
+}
+
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// the next whitespace-separated token, as operator>> reads it
+template <std::size_t MemorySize>
+constexpr std::string_view ConstexprCpu<MemorySize>::nextToken(std::string_view& rest)
+{
+	std::size_t begin = 0;
+	while (begin < rest.size() && isSpace(rest[begin])) {
+		++begin;
+	}
+	std::size_t end = begin;
+	while (end < rest.size() && !isSpace(rest[end])) {
+		++end;
+	}
+	std::string_view token = rest.substr(begin, end - begin);
+	rest.remove_prefix(end);
+	return token;
+}
+
+// what decodeOperand accepts from strtol: an optional sign, decimal digits, in int range
+template <std::size_t MemorySize>
+constexpr bool ConstexprCpu<MemorySize>::parseInt(std::string_view number, int& value)
+{
+	bool negative = !number.empty() && number.front() == '-';
+	if (!number.empty() && (number.front() == '-' || number.front() == '+')) {
+		number.remove_prefix(1);
+	}
+	if (number.empty()) {
+		return false;
+	}
+	long long magnitude = 0;
+	for (char c : number) {
+		if (c < '0' || c > '9') {
+			return false;
+		}
+		magnitude = magnitude * 10 + (c - '0');
+		if (magnitude > static_cast<long long>(std::numeric_limits<int>::max()) + 1) {
+			return false;
+		}
+	}
+	long long signedValue = negative ? -magnitude : magnitude;
+	if (signedValue > std::numeric_limits<int>::max()) {
+		return false;
+	}
+	value = static_cast<int>(signedValue);
+	return true;
+}
+
+// two's complement truncation to int, without the implementation-defined conversion
+template <std::size_t MemorySize>
+constexpr int ConstexprCpu<MemorySize>::wrap(long long value)
+{
+	long long low = value & 0xffffffffLL;
+	return static_cast<int>(low > std::numeric_limits<int>::max() ? low - 0x100000000LL : low);
+}
@@ -1,766 +1,1412 @@
 #include "Cpu.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Timing.h"
+#include "Object.h"
+#include "Jit.h"
 #include <iostream>
 #include <vector>
 #include <map>
 #include <string>
 #include <fstream>
 #include <sstream>
-#include <bitset>
 #include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <atomic>
 
-Cpu::Cpu() 
-    : instSize(0)
+Cpu::Cpu(Engine engine, std::size_t cells)
+    : engine(engine)
+    , memorySize(std::min(std::max<std::size_t>(cells, 1), maxMemorySize))
+    , instSize(0)
+    , retired(0)
+    , stepLimit(0)
+    , profiler(nullptr)
+    , tracer(nullptr)
+    , timingModel(nullptr)
+    , accessAddress(-1)
     , smthWentWrong(false)
+    , errorStream(&std::cerr)
 {
-    registers["AYB"] = 0; // accumulator
-    registers["BEN"] = 0;
-    registers["GIM"] = 0;
-    registers["DA"] = 0; // for CMP
-    registers["ECH"] = 0;
-    registers["ZA"] = 0;
-    registers["GH"] = 0; // analogue of EIP
+    registers.fill(0);
 
-    // Initialize memory to zero
-    memory.resize(memorySize, "0");
+    // Initialize memory to zero, pages are only allocated by load
+    pages.resize((memorySize + pageCells - 1) / pageCells, zeroPage());
+    pageOwned.resize(pages.size(), 0);
+    pageTable.resize(pages.size(), nullptr);
+    program = std::make_shared<const Program>();
 }
 
 void Cpu::load(const std::string& file)
 {
-    memory.resize(memorySize, "0");
-    std::string instruction;
     std::ifstream fin;
     fin.open(file);
     if (!fin.is_open()) {
-        std::cerr << "ERROR while opening file\n";
-        smthWentWrong = true;
+        clear();
+        error("ERROR while opening file");
         return;
     }
-    while (std::getline(fin, instruction)) {
-        memory.insert(memory.begin() + instSize, instruction);
-        ++instSize;
-    }
-    if (instSize > memorySize) {
-        std::cerr << "Instructions exceed program memory\n";
-        smthWentWrong = true;
+    char magic[sizeof(objectMagic)] = {};
+    fin.read(magic, sizeof(magic));
+    if (fin.gcount() == sizeof(magic) && std::memcmp(magic, objectMagic, sizeof(magic)) == 0) {
+        fin.close();
+        load_object(file);
         return;
     }
+    fin.clear();
+    fin.seekg(0);
+    load(fin);
     fin.close();
 }
 
-int Cpu::findLabelAddress(const std::string& label)
+void Cpu::load(std::istream& in)
 {
-    std::string label1 = label + ":";
-    for (int i = 0; i < instSize; ++i) {
-        std::string operation;
-        std::istringstream iss(memory[i]);
-        iss >> operation;
-        if (operation == label1) {
-            return i;
+    // nothing of a previously loaded program or run carries over
+    clear();
+    auto loaded = std::make_shared<Program>();
+    loaded->memorySize = memorySize;
+    program = loaded;
+    std::string instruction;
+    // first pass: collect labels and keep the text of every instruction
+    while (std::getline(in, instruction)) {
+        if (instSize >= memorySize) {
+            error("Instructions exceed program memory");
+            return;
+        }
+        // "label: ADD AYB , BEN" keeps only "ADD AYB , BEN" as text, the label is remembered separately
+        std::string label;
+        std::istringstream iss(instruction);
+        iss >> label;
+        if (!label.empty() && label.back() == ':') {
+            label.pop_back();
+            if (!symbols.emplace(label, static_cast<int>(instSize)).second) {
+                error("Label " + label + " is defined more than once");
+                return;
+            }
+            loaded->labels[static_cast<int>(instSize)] = label;
+            instruction = instruction.substr(instruction.find(':') + 1);
+            instruction.erase(0, instruction.find_first_not_of(' '));
+        }
+        loaded->text.push_back(instruction);
+        ++instSize;
+    }
+
+    // second pass: decode, jump targets are resolved through the symbol table
+    loaded->instructions.resize(instSize);
+    for (std::size_t i = 0; i < instSize; ++i) {
+        if (!decode(loaded->text[i], loaded->instructions[i])) {
+            return;
         }
     }
-    return -1; // if not found
+    fuse(*loaded);
+    prepareRun();
 }
 
-// Please in input file, in instructions with 2 operands, write commas (,) after whitespase
-// E.g. MOV BEN , 24
+namespace {
+
+constexpr std::uint8_t daBit = 1u << static_cast<unsigned>(Register::DA);
+constexpr std::uint8_t zaBit = 1u << static_cast<unsigned>(Register::ZA);
+
+// two's complement truncation, arithmetic wraps instead of overflowing
+int wrap(long long value)
+{
+    return static_cast<int>(static_cast<std::uint32_t>(value));
+}
+
+// GH after an ordinary instruction, which may have left it at INT_MAX
+int nextAddress(int gh)
+{
+    return wrap(static_cast<long long>(gh) + 1);
+}
+
+// what CMP puts in DA: the sign of the wrapped difference
+int compareResult(int left, int right)
+{
+    int difference = wrap(static_cast<long long>(left) - right);
+    return (difference > 0) - (difference < 0);
+}
 
-void Cpu::execute(const std::string& file)
+long long exactResult(Opcode op, int left, int right)
+{
+    switch (op) {
+    case Opcode::ADD: return static_cast<long long>(left) + right;
+    case Opcode::SUB: return static_cast<long long>(left) - right;
+    case Opcode::MUL: return static_cast<long long>(left) * right;
+    default: return static_cast<long long>(left) / right; // DIV, never recorded with a zero divisor
+    }
+}
+
+bool isMemory(const Operand& operand)
+{
+    return operand.kind == OperandKind::Memory || operand.kind == OperandKind::Indirect;
+}
+
+bool isSuperinstruction(Opcode op)
+{
+    return op == Opcode::CMP_JG || op == Opcode::CMP_JL || op == Opcode::CMP_JE || op == Opcode::MOV_ADD;
+}
+
+// Read-modify-writes of a cell other cores may be using, as lock-free host atomics.
+// Cells stay plain ints, so every other access, the JIT's included, is an ordinary
+// load or store. Both return what the cell held before.
+#if defined(__GNUC__)
+int compareExchange(int& cell, int expected, int desired)
+{
+    __atomic_compare_exchange_n(&cell, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+int fetchAdd(int& cell, int value)
+{
+    return __atomic_fetch_add(&cell, value, __ATOMIC_SEQ_CST);
+}
+#else
+static_assert(sizeof(std::atomic<int>) == sizeof(int) && std::atomic<int>::is_always_lock_free,
+    "cells are used as std::atomic<int>");
+
+int compareExchange(int& cell, int expected, int desired)
+{
+    reinterpret_cast<std::atomic<int>&>(cell).compare_exchange_strong(expected, desired);
+    return expected;
+}
+
+int fetchAdd(int& cell, int value)
+{
+    return reinterpret_cast<std::atomic<int>&>(cell).fetch_add(value);
+}
+#endif
+
+// The checks decode makes on source text, for instructions that come from an object file
+bool validObjectInstruction(const Instruction& inst, std::size_t instCount)
+{
+    auto validOperand = [](const Operand& operand) {
+        switch (operand.kind) {
+        case OperandKind::Register:
+            return operand.value >= 0 && operand.value < static_cast<int>(registerCount);
+        case OperandKind::Indirect:
+        case OperandKind::Memory:
+        case OperandKind::Immediate:
+            return true;
+        default:
+            return false;
+        }
+    };
+
+    // the base nibble is unpacked for every operand, whatever its kind
+    if (static_cast<std::size_t>(inst.dst.base) >= registerCount
+        || static_cast<std::size_t>(inst.src.base) >= registerCount) {
+        return false;
+    }
+    switch (inst.opcode) {
+    case Opcode::JMP:
+    case Opcode::JG:
+    case Opcode::JL:
+    case Opcode::JE:
+        return inst.dst.kind == OperandKind::Label && inst.dst.value >= 0
+            && inst.dst.value <= static_cast<int>(instCount) && inst.src.kind == OperandKind::None;
+    case Opcode::NOT:
+        return validOperand(inst.dst) && inst.dst.kind != OperandKind::Immediate && inst.src.kind == OperandKind::None;
+    case Opcode::FENCE:
+        return inst.dst.kind == OperandKind::None && inst.src.kind == OperandKind::None;
+    case Opcode::CAS:
+    case Opcode::XADD:
+        if (!isMemory(inst.dst)) {
+            return false;
+        }
+        break;
+    case Opcode::MUL:
+    case Opcode::DIV:
+        if (inst.dst.kind != OperandKind::Register) {
+            return false;
+        }
+        break;
+    case Opcode::MOV:
+    case Opcode::ADD:
+    case Opcode::SUB:
+    case Opcode::AND:
+    case Opcode::OR:
+    case Opcode::CMP:
+        break;
+    default:
+        return false; // superinstructions are never stored
+    }
+    return validOperand(inst.dst) && validOperand(inst.src) && inst.dst.kind != OperandKind::Immediate
+        && !(isMemory(inst.dst) && isMemory(inst.src));
+}
+
+}
+
+void Cpu::load_object(const std::string& file)
+{
+    MappedFile object;
+    if (!object.open(file)) {
+        clear();
+        error("ERROR while opening file");
+        return;
+    }
+    load_object(object.data(), object.size());
+}
+
+// Copies the records straight into a Program, nothing is parsed
+void Cpu::load_object(const std::uint8_t* data, std::size_t size)
 {
     clear();
-    load(file); // fetch
-    
-    //decode, execute
-    while (registers["GH"] < instSize) {
-        std::string operation;
-        std::istringstream iss(memory[registers["GH"]]);
-        iss >> operation;
-
-        if (operation == "MOV") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
-
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    registers[op1] = registers[op2];
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    registers[op1] = std::stoi(memory[memAddress]);
-                }
-                else {
-                    // op2 is an immediate value
-                    registers[op1] = std::stoi(op2);
-                }
-            }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    memory.insert(memory.begin() + memAddress, std::to_string(registers[op2]));
-                }
-                else {
-                    // op2 is an immediate value
-                    memory.insert(memory.begin() + memAddress, op2);
-                }
-            }
+    ObjectHeader header;
+    if (size < sizeof(header)) {
+        error("Corrupt object file");
+        return;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    std::uint64_t expected = sizeof(header)
+        + std::uint64_t(header.instructionCount) * sizeof(ObjectInstruction)
+        + std::uint64_t(header.labelCount) * sizeof(ObjectLabel)
+        + std::uint64_t(header.dataCount) * sizeof(ObjectData)
+        + header.stringBytes;
+    if (std::memcmp(header.magic, objectMagic, sizeof(objectMagic)) != 0 || header.version != objectVersion
+        || expected != size) {
+        error("Corrupt object file");
+        return;
+    }
+    if (header.instructionCount > memorySize) {
+        error("Instructions exceed program memory");
+        return;
+    }
+
+    auto loaded = std::make_shared<Program>();
+    loaded->memorySize = memorySize;
+    program = loaded;
+    instSize = header.instructionCount;
+    const std::uint8_t* records = data + sizeof(header);
+    const std::uint8_t* labelRecords = records + instSize * sizeof(ObjectInstruction);
+    const std::uint8_t* dataRecords = labelRecords + header.labelCount * sizeof(ObjectLabel);
+    const char* strings = reinterpret_cast<const char*>(dataRecords + header.dataCount * sizeof(ObjectData));
+    auto validString = [&header](std::uint32_t offset, std::uint32_t length) {
+        return offset <= header.stringBytes && length <= header.stringBytes - offset;
+    };
+
+    loaded->instructions.resize(instSize);
+    loaded->text.resize(instSize);
+    for (std::size_t i = 0; i < instSize; ++i) {
+        ObjectInstruction record;
+        std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+        Instruction& inst = loaded->instructions[i];
+        inst.opcode = static_cast<Opcode>(record.opcode);
+        unpackKind(record.dstKind, inst.dst);
+        inst.dst.value = record.dst;
+        unpackKind(record.srcKind, inst.src);
+        inst.src.value = record.src;
+        if (!validObjectInstruction(inst, instSize) || !validString(record.textOffset, record.textLength)) {
+            error("Corrupt object file");
+            return;
         }
+        if (!checkAddresses(inst)) {
+            return;
+        }
+        loaded->text[i].assign(strings + record.textOffset, record.textLength);
+    }
+    for (std::size_t i = 0; i < header.labelCount; ++i) {
+        ObjectLabel record;
+        std::memcpy(&record, labelRecords + i * sizeof(record), sizeof(record));
+        if (record.address >= instSize || !validString(record.nameOffset, record.nameLength)) {
+            error("Corrupt object file");
+            return;
+        }
+        std::string name(strings + record.nameOffset, record.nameLength);
+        loaded->labels[static_cast<int>(record.address)] = name;
+        symbols.emplace(name, static_cast<int>(record.address));
+    }
+    for (std::size_t i = 0; i < header.dataCount; ++i) {
+        ObjectData record;
+        std::memcpy(&record, dataRecords + i * sizeof(record), sizeof(record));
+        if (record.address < instSize || record.address >= memorySize) {
+            error("Corrupt object file");
+            return;
+        }
+        loaded->data.emplace_back(static_cast<int>(record.address), record.value);
+        writableCell(record.address) = record.value;
+    }
+    fuse(*loaded);
+    prepareRun();
+}
 
-        else if (operation == "ADD") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
-
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    registers[op1] += registers[op2];
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    } 
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    registers[op1] += std::stoi(memory[memAddress]);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    registers[op1] += std::stoi(op2);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-            }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    int sum = std::stoi(memory.at(memAddress)) + registers[op2];
-                    memory.insert(memory.begin() + memAddress, std::to_string(sum));
-                    //overflow case
-                    if (sum > std::numeric_limits<int>::max() || sum < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    int sum = std::stoi(memory.at(memAddress)) + std::stoi(op2);
-                    memory.insert(memory.begin() + memAddress, std::to_string(sum));
-                    //overflow case
-                    if (sum > std::numeric_limits<int>::max() || sum < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-            }
+bool Cpu::save_object(const std::string& file) const
+{
+    if (smthWentWrong) {
+        return false;
+    }
+    std::string strings;
+    std::vector<ObjectInstruction> records(instSize);
+    for (std::size_t i = 0; i < instSize; ++i) {
+        const Instruction& inst = program->instructions[i];
+        ObjectInstruction& record = records[i];
+        record.opcode = static_cast<std::uint8_t>(inst.opcode);
+        record.dstKind = packKind(inst.dst);
+        record.srcKind = packKind(inst.src);
+        record.reserved = 0;
+        record.dst = inst.dst.value;
+        record.src = inst.src.value;
+        record.textOffset = static_cast<std::uint32_t>(strings.size());
+        record.textLength = static_cast<std::uint32_t>(program->text[i].size());
+        strings += program->text[i];
+    }
+    std::vector<ObjectLabel> labelRecords;
+    for (const auto& label : program->labels) {
+        labelRecords.push_back({ static_cast<std::uint32_t>(label.first), static_cast<std::uint32_t>(strings.size()),
+            static_cast<std::uint32_t>(label.second.size()) });
+        strings += label.second;
+    }
+    std::vector<ObjectData> dataRecords;
+    for (std::size_t i = instSize; i < memorySize; ++i) {
+        if (cell(i) != 0) {
+            dataRecords.push_back({ static_cast<std::uint32_t>(i), cell(i) });
         }
+    }
 
-        else if (operation == "SUB") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
-
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    registers[op1] -= registers[op2];
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    registers[op1] -= std::stoi(memory[memAddress]);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    registers[op1] -= std::stoi(op2);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
+    ObjectHeader header;
+    std::memcpy(header.magic, objectMagic, sizeof(objectMagic));
+    header.version = objectVersion;
+    header.instructionCount = static_cast<std::uint32_t>(instSize);
+    header.labelCount = static_cast<std::uint32_t>(labelRecords.size());
+    header.dataCount = static_cast<std::uint32_t>(dataRecords.size());
+    header.stringBytes = static_cast<std::uint32_t>(strings.size());
+    header.reserved = 0;
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(ObjectInstruction));
+    out.write(reinterpret_cast<const char*>(labelRecords.data()), labelRecords.size() * sizeof(ObjectLabel));
+    out.write(reinterpret_cast<const char*>(dataRecords.data()), dataRecords.size() * sizeof(ObjectData));
+    out.write(strings.data(), strings.size());
+    return static_cast<bool>(out);
+}
+
+void Cpu::load(std::shared_ptr<const Program> decoded)
+{
+    clear();
+    if (decoded->memorySize > memorySize) {
+        error("The program was decoded for a larger memory");
+        return;
+    }
+    program = std::move(decoded);
+    instSize = program->instructions.size();
+    for (const auto& initial : program->data) {
+        writableCell(initial.first) = initial.second;
+    }
+    prepareRun();
+}
+
+// Everything run needs that would otherwise be built on the first run
+void Cpu::prepareRun()
+{
+    // handlers of the previous program must not survive, even when the count matches
+    threadedCode.clear();
+    threadedHandlers = nullptr;
+    threadedCode.reserve(instSize); // so run doesn't allocate
+    jitCode.reset();
+    if (engine == Engine::Jit) {
+        jitCode = JitCode::compile(*program, memorySize, pageCells);
+    }
+}
+
+std::shared_ptr<const Program> Cpu::loaded_program() const
+{
+    return program;
+}
+
+// Retags the first instruction of a common pair so one dispatch runs both.
+// The second instruction stays where it is, jumps that land on it still work.
+void Cpu::fuse(Program& loaded)
+{
+    std::vector<Instruction>& code = loaded.code;
+    code = loaded.instructions;
+    // which lazy flags each instruction needs materialized, see alu
+    for (Instruction& inst : code) {
+        for (const Operand* operand : { &inst.dst, &inst.src }) {
+            if (operand->kind == OperandKind::Register || operand->kind == OperandKind::Indirect) {
+                Register r = operand->kind == OperandKind::Register ? static_cast<Register>(operand->value) : operand->base;
+                if (r == Register::DA || r == Register::ZA) {
+                    inst.flagOperands |= 1u << static_cast<unsigned>(r);
                 }
             }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    int sub = std::stoi(memory.at(memAddress)) - registers[op2];
-                    memory.insert(memory.begin() + memAddress, std::to_string(sub));
-                    //overflow case
-                    if (sub > std::numeric_limits<int>::max() || sub < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    int sub = std::stoi(memory.at(memAddress)) - std::stoi(op2);
-                    memory.insert(memory.begin() + memAddress, std::to_string(sub));
-                    //overflow case
-                    if (sub > std::numeric_limits<int>::max() || sub < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
+        }
+    }
+    for (std::size_t i = 0; i + 1 < instSize; ++i) {
+        Instruction& first = code[i];
+        const Instruction& second = loaded.instructions[i + 1];
+        if (first.opcode == Opcode::CMP) {
+            if (second.opcode == Opcode::JG) {
+                first.opcode = Opcode::CMP_JG;
+            }
+            else if (second.opcode == Opcode::JL) {
+                first.opcode = Opcode::CMP_JL;
+            }
+            else if (second.opcode == Opcode::JE) {
+                first.opcode = Opcode::CMP_JE;
             }
         }
+        else if (first.opcode == Opcode::MOV && second.opcode == Opcode::ADD
+            && first.dst.kind == OperandKind::Register && first.src.kind == OperandKind::Immediate
+            && first.dst.value != static_cast<int>(Register::GH)) {
+            first.opcode = Opcode::MOV_ADD;
+        }
+    }
+}
 
-        else if (operation == "MUL") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
-
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    registers[op1] *= registers[op2];
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    registers[op1] *= std::stoi(memory[memAddress]);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    registers[op1] *= std::stoi(op2);
-                    //overflow case
-                    if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                        registers["ZA"] = 1;
-                    }
-                }
-            }
+// Please in input file, in instructions with 2 operands, write commas (,) after whitespase
+// E.g. MOV BEN , 24
+
+bool Cpu::decode(const std::string& line, Instruction& inst)
+{
+    static const std::map<std::string, Opcode> opcodes = {
+        { "MOV", Opcode::MOV }, { "ADD", Opcode::ADD }, { "SUB", Opcode::SUB },
+        { "MUL", Opcode::MUL }, { "DIV", Opcode::DIV }, { "AND", Opcode::AND },
+        { "OR", Opcode::OR }, { "NOT", Opcode::NOT }, { "CMP", Opcode::CMP },
+        { "JMP", Opcode::JMP }, { "JG", Opcode::JG }, { "JL", Opcode::JL },
+        { "JE", Opcode::JE }, { "CAS", Opcode::CAS }, { "XADD", Opcode::XADD },
+        { "FENCE", Opcode::FENCE }
+    };
+
+    std::string operation;
+    std::istringstream iss(line);
+    iss >> operation;
+    auto opcodeIt = opcodes.find(operation);
+    if (opcodeIt == opcodes.end()) {
+        error("Incorrect instruction provided");
+        return false;
+    }
+    inst.opcode = opcodeIt->second;
+
+    switch (inst.opcode) {
+    case Opcode::JMP:
+    case Opcode::JG:
+    case Opcode::JL:
+    case Opcode::JE: {
+        std::string label;
+        iss >> label;
+        auto symbolIt = symbols.find(label);
+        if (symbolIt == symbols.end()) {
+            error("Label " + label + " is not defined");
+            return false;
         }
+        inst.dst.kind = OperandKind::Label;
+        inst.dst.value = symbolIt->second;
+        return true;
+    }
+    case Opcode::NOT: {
+        std::string op;
+        iss >> op;
+        if (!decodeOperand(op, inst.dst) || inst.dst.kind == OperandKind::Immediate) {
+            error("Incorrect operand provided");
+            return false;
+        }
+        return true;
+    }
+    case Opcode::FENCE:
+        return true;
+    default:
+        break;
+    }
 
-        else if (operation == "DIV") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
-
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    if (registers[op2] != 0) {
-                        registers[op1] /= registers[op2];
-                        //overflow case
-                        if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                            registers["ZA"] = 1;
-                        }
-                    }
-                    else {
-                        std::cerr << "Can't divide by zero\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    if (std::stoi(memory[memAddress]) != 0) {
-                        registers[op1] /= std::stoi(memory[memAddress]);
-                        //overflow case
-                        if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                            registers["ZA"] = 1;
-                        }
-                    }
-                    else {
-                        std::cerr << "Can't divide by zero\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                }
-                else {
-                    // op2 is an immediate value
-                    if (std::stoi(op2) != 0) {
-                        registers[op1] /= std::stoi(op2);
-                        //overflow case
-                        if (registers[op1] > std::numeric_limits<int>::max() || registers[op1] < std::numeric_limits<int>::min()) {
-                            registers["ZA"] = 1;
-                        }
-                    }
-                    else {
-                        std::cerr << "Can't divide by zero\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                }
+    std::string op1;
+    std::string op2;
+    std::string comma;
+    iss >> op1 >> comma >> op2;
+    if (comma != "," || !decodeOperand(op1, inst.dst) || !decodeOperand(op2, inst.src)) {
+        error("Incorrect operands provided");
+        return false;
+    }
+    if (inst.dst.kind == OperandKind::Immediate) {
+        error("Destination can't be an immediate value");
+        return false;
+    }
+    if (isMemory(inst.dst) && isMemory(inst.src)) {
+        error("Both operands can't be memory addresses");
+        return false;
+    }
+    if ((inst.opcode == Opcode::MUL || inst.opcode == Opcode::DIV) && inst.dst.kind != OperandKind::Register) {
+        error("MUL and DIV work only with a register destination");
+        return false;
+    }
+    if ((inst.opcode == Opcode::CAS || inst.opcode == Opcode::XADD) && !isMemory(inst.dst)) {
+        error("CAS and XADD work only with a memory destination");
+        return false;
+    }
+    return checkAddresses(inst);
+}
+
+bool Cpu::decodeOperand(const std::string& token, Operand& operand)
+{
+    if (token.empty()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < registerCount; ++i) {
+        if (token == registerNames[i]) {
+            operand.kind = OperandKind::Register;
+            operand.value = static_cast<int>(i);
+            return true;
+        }
+    }
+    std::string number = token;
+    operand.kind = OperandKind::Immediate;
+    if (token.size() >= 3 && token.front() == '[' && token.back() == ']') {
+        number = token.substr(1, token.size() - 2);
+        operand.kind = OperandKind::Memory;
+        // [REG], [REG+imm] or [REG-imm]
+        std::size_t sign = number.find_first_of("+-", 1);
+        std::string base = number.substr(0, sign);
+        for (std::size_t i = 0; i < registerCount; ++i) {
+            if (base == registerNames[i]) {
+                operand.kind = OperandKind::Indirect;
+                operand.base = static_cast<Register>(i);
+                number = sign == std::string::npos ? "0" : number.substr(number[sign] == '+' ? sign + 1 : sign);
+                break;
             }
         }
+    }
+    char* end = nullptr;
+    long value = std::strtol(number.c_str(), &end, 10);
+    if (number.empty() || *end != '\0' || value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+        return false;
+    }
+    operand.value = static_cast<int>(value);
+    return true;
+}
 
-        else if (operation == "AND") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
+// Memory operands are constant, so their addresses are checked once here instead of on every access
+bool Cpu::checkAddresses(const Instruction& inst)
+{
+    return (inst.dst.kind != OperandKind::Memory || checkAddress(inst.dst.value))
+        && (inst.src.kind != OperandKind::Memory || checkAddress(inst.src.value));
+}
 
-            std::bitset<sizeof(int) * 8> bits1;
-            std::bitset<sizeof(int) * 8> bits2;
+bool Cpu::checkAddress(int memAddress)
+{
+    if (memAddress < static_cast<int>(instSize)) {
+        error("The memory address you try to use is occupied by instructions");
+        return false;
+    }
+    else if (memAddress >= static_cast<int>(memorySize)) {
+        error("The memory exceeds program memory");
+        return false;
+    }
+    return true;
+}
 
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    bits1 = registers[op1];
-                    bits2 = registers[op2];
-                    registers[op1] = (int)(bits1 & bits2).to_ulong();
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    bits1 = registers[op1];
-                    bits2 = std::stoi(memory[memAddress]);;
-                    registers[op1] = (int)(bits1 & bits2).to_ulong();
-                }
-                else {
-                    // op2 is an immediate value
-                    bits1 = registers[op1];
-                    bits2 = std::stoi(op2);
-                    registers[op1] = (int)(bits1 & bits2).to_ulong();
-                }
-            }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    bits1 = std::stoi(memory[memAddress]);
-                    bits2 = registers[op2];
-                    memory.insert(memory.begin() + memAddress, (bits1& bits2).to_string());
-                }
-                else {
-                    // op2 is an immediate value
-                    bits1 = std::stoi(memory[memAddress]);
-                    bits2 = std::stoi(op2);
-                    memory.insert(memory.begin() + memAddress, (bits1& bits2).to_string());
-                }
-            }
+// The one address check left at run time, the base register is only known now
+bool Cpu::indirectAddress(const Operand& operand, int& address)
+{
+    long long target = static_cast<long long>(registers[static_cast<std::size_t>(operand.base)]) + operand.value;
+    address = static_cast<int>(std::min(std::max(target, -1LL), static_cast<long long>(memorySize)));
+    return checkAddress(address);
+}
+
+inline bool Cpu::readOperand(const Operand& operand, int& value)
+{
+    switch (operand.kind) {
+    case OperandKind::Register:
+        value = registers[operand.value];
+        return true;
+    case OperandKind::Memory:
+        value = cell(operand.value);
+        return true;
+    case OperandKind::Indirect: {
+        int address;
+        if (!indirectAddress(operand, address)) {
+            return false;
         }
+        value = cell(address);
+        return true;
+    }
+    case OperandKind::Immediate:
+        value = operand.value;
+        return true;
+    default:
+        smthWentWrong = true;
+        return false;
+    }
+}
 
-        else if (operation == "OR") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
+inline bool Cpu::writeOperand(const Operand& operand, int value)
+{
+    switch (operand.kind) {
+    case OperandKind::Register:
+        registers[operand.value] = value;
+        return true;
+    case OperandKind::Memory:
+        writableCell(operand.value) = value;
+        return true;
+    case OperandKind::Indirect: {
+        int address;
+        if (!indirectAddress(operand, address)) {
+            return false;
+        }
+        writableCell(address) = value;
+        return true;
+    }
+    default:
+        smthWentWrong = true;
+        return false;
+    }
+}
 
-            std::bitset<sizeof(int) * 8> bits1;
-            std::bitset<sizeof(int) * 8> bits2;
+// Shared by both dispatch engines, every opcode gets its own instantiation
+template <Opcode op>
+bool Cpu::alu(const Instruction& inst)
+{
+    // flags an operand reads or overwrites have to be up to date first
+    if (inst.flagOperands & lazyRegisters) {
+        materialize();
+    }
+    int value1 = 0;
+    int value2 = 0;
+    if constexpr (op != Opcode::MOV) {
+        if (!readOperand(inst.dst, value1)) {
+            return false;
+        }
+    }
+    if constexpr (op != Opcode::NOT) {
+        if (!readOperand(inst.src, value2)) {
+            return false;
+        }
+    }
 
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    bits1 = registers[op1];
-                    bits2 = registers[op2];
-                    registers[op1] = (int)(bits1 | bits2).to_ulong();
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    bits1 = registers[op1];
-                    bits2 = std::stoi(memory[memAddress]);
-                    registers[op1] = (int)(bits1 | bits2).to_ulong();
-                }
-                else {
-                    // op2 is an immediate value
-                    bits1 = registers[op1];
-                    bits2 = std::stoi(op2);
-                    registers[op1] = (int)(bits1 | bits2).to_ulong();
-                }
-            }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    bits1 = std::stoi(memory[memAddress]);
-                    bits2 = registers[op2];
-                    memory.insert(memory.begin() + memAddress, (bits1 | bits2).to_string());
-                }
-                else {
-                    // op2 is an immediate value
-                    bits1 = std::stoi(memory[memAddress]);
-                    bits2 = std::stoi(op2);
-                    memory.insert(memory.begin() + memAddress, (bits1 | bits2).to_string());
-                }
-            }
+    if constexpr (op == Opcode::MOV) {
+        return writeOperand(inst.dst, value2);
+    }
+    else if constexpr (op == Opcode::AND) {
+        return writeOperand(inst.dst, value1 & value2);
+    }
+    else if constexpr (op == Opcode::OR) {
+        return writeOperand(inst.dst, value1 | value2);
+    }
+    else if constexpr (op == Opcode::NOT) {
+        return writeOperand(inst.dst, ~value1);
+    }
+    else if constexpr (op == Opcode::CMP) {
+        flags.compareLeft = value1;
+        flags.compareRight = value2;
+        lazyRegisters |= daBit;
+        return true;
+    }
+    else {
+        // ADD, SUB, MUL, DIV: ZA says whether the result overflowed, unless ZA is the destination
+        if (op == Opcode::DIV && value2 == 0) {
+            error("Can't divide by zero");
+            return false;
+        }
+        if (!writeOperand(inst.dst, wrap(exactResult(op, value1, value2)))) {
+            return false;
         }
+        if (inst.dst.kind != OperandKind::Register || inst.dst.value != static_cast<int>(Register::ZA)) {
+            flags.arithmetic = op;
+            flags.arithmeticLeft = value1;
+            flags.arithmeticRight = value2;
+            lazyRegisters |= zaBit;
+        }
+        return true;
+    }
+}
 
-        else if (operation == "NOT") {
-            std::string op;
-            iss >> op;
-            std::bitset<sizeof(int) * 8> bits;
-            if (registers.find(op) != registers.end()) {
-                // op is a register
-                bits = registers[op];
-                registers[op] = (int)(~bits).to_ulong();
-            }
-            else {
-                // op is a memory address
-                int memAddress = std::stoi(op.substr(1, op.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                bits = std::stoi(memory[memAddress]);
-                memory.insert(memory.begin() + memAddress, (~bits).to_string());
-            }
+// CAS, XADD and FENCE. The cell changes in one host atomic step, so cores sharing
+// memory never interleave inside one; AYB gets the value it held before.
+template <Opcode op>
+bool Cpu::atomicAlu(const Instruction& inst)
+{
+    if constexpr (op == Opcode::FENCE) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return true;
+    }
+    else {
+        if (inst.flagOperands & lazyRegisters) {
+            materialize();
+        }
+        int value = 0;
+        int address = inst.dst.value;
+        if (!readOperand(inst.src, value)
+            || (inst.dst.kind == OperandKind::Indirect && !indirectAddress(inst.dst, address))) {
+            return false;
+        }
+        int& target = writableCell(static_cast<std::size_t>(address));
+        if constexpr (op == Opcode::CAS) {
+            reg(Register::AYB) = compareExchange(target, reg(Register::AYB), value);
         }
+        else {
+            reg(Register::AYB) = fetchAdd(target, value);
+        }
+        return true;
+    }
+}
 
-        else if (operation == "CMP") {
-            std::string op1;
-            std::string op2;
-            std::string comma;
-            iss >> op1 >> comma >> op2;
+template <Opcode op>
+bool Cpu::taken()
+{
+    // straight from the recorded compare, DA itself stays lazy
+    int da = (lazyRegisters & daBit) ? compareResult(flags.compareLeft, flags.compareRight) : reg(Register::DA);
+    if constexpr (op == Opcode::JG) {
+        return da == 1;
+    }
+    else if constexpr (op == Opcode::JL) {
+        return da == -1;
+    }
+    else if constexpr (op == Opcode::JE) {
+        return da == 0;
+    }
+    else {
+        return true;
+    }
+}
 
-            int value1 = 0;
-            int value2 = 0;
+Cpu::RunStatus Cpu::execute(const std::string& file, std::uint64_t maxSteps)
+{
+    clear();
+    load(file); // fetch, decode
+    return run(maxSteps);
+}
 
-            if (registers.find(op1) != registers.end()) {
-                // op1 is a register
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    value1 = registers[op1];
-                    value2 = registers[op2];
-                }
-                else if (op2.size() >= 3 && op2.size() <= 4 && op2[0] == '[' && op2[op2.size() - 1] == ']') {
-                    // op2 is a memory address
-                    int memAddress = std::stoi(op2.substr(1, op2.size() - 2));
-                    if (memAddress < instSize) {
-                        std::cerr << "The memory address you try to use is occupied by instructions\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    else if (memAddress >= memorySize) {
-                        std::cerr << "The memory exceeds program memory\n";
-                        smthWentWrong = true;
-                        return;
-                    }
-                    value1 = registers[op1];
-                    value2 = std::stoi(memory[memAddress]);
-                }
-                else {
-                    // op2 is an immediate value
-                    value1 = registers[op1];
-                    value2 = std::stoi(op2);
-                }
-            }
-            else {
-                // op1 is a memory address
-                int memAddress = std::stoi(op1.substr(1, op1.size() - 2));
-                if (memAddress < instSize) {
-                    std::cerr << "The memory address you try to use is occupied by instructions\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                else if (memAddress >= memorySize) {
-                    std::cerr << "The memory exceeds program memory\n";
-                    smthWentWrong = true;
-                    return;
-                }
-                if (registers.find(op2) != registers.end()) {
-                    // op2 is a register
-                    value1 = std::stoi(memory[memAddress]);
-                    value2 = registers[op2];
-                }
-                else {
-                    // op2 is an immediate value
-                    value1 = std::stoi(memory[memAddress]);
-                    value2 = std::stoi(op2);
-                }
-            }
-            int result = value1 - value2;
-            if (result < 0) {
-                registers["DA"] = -1; // if op1 is less than op2, register Da is set to -1
-            }
-            else if (result > 0) {
-                registers["DA"] = 1; // if op1 is greater than op2, register Da is set to 1
-            }
-            else {
-                registers["DA"] = 0; // if op1 is equal to op2, register Da is set to 1
-            }
+Cpu::RunStatus Cpu::execute(std::istream& in, std::uint64_t maxSteps)
+{
+    clear();
+    load(in);
+    return run(maxSteps);
+}
+
+Cpu::RunStatus Cpu::run(std::uint64_t maxSteps)
+{
+    if (smthWentWrong) {
+        return RunStatus::Error;
+    }
+
+    stepLimit = maxSteps > std::numeric_limits<std::uint64_t>::max() - retired
+        ? std::numeric_limits<std::uint64_t>::max()
+        : retired + maxSteps;
+
+    // instrumentation is a separate instantiation so the plain loops pay nothing for it
+    if (profiler != nullptr || tracer != nullptr || timingModel != nullptr) {
+        if (engine == Engine::Switch) {
+            runSwitch<true>();
+        }
+        else {
+            runThreaded<true>();
         }
+        if (profiler != nullptr) {
+            profiler->finish();
+        }
+    }
+    else if (engine == Engine::Jit && jitCode != nullptr) {
+        runJit();
+    }
+    else if (engine == Engine::Switch) {
+        runSwitch<false>();
+    }
+    else {
+        runThreaded<false>();
+    }
 
-        else if (operation == "JMP") {
-            std::string label;
-            iss >> label;
-            int address = findLabelAddress(label);
-            if (address == -1) {
-                std::cerr << "Label not found\n";
-                smthWentWrong = true;
-                return;
-            }
-            else {
-                labels[address] = label;
-                registers["GH"] = address;
-                std::size_t firstSpace = memory[registers["GH"]].find(' ');
-                if (firstSpace != std::string::npos) {
-                    memory[registers["GH"]] = memory[registers["GH"]].substr(firstSpace + 1);
-                    continue;
-                }
-                else {
-                    smthWentWrong = true;
-                    return;
-                }
-            }
+    if (smthWentWrong) {
+        return RunStatus::Error;
+    }
+    if (static_cast<std::size_t>(reg(Register::GH)) < instSize) {
+        return RunStatus::BudgetExhausted;
+    }
+    return RunStatus::Halted;
+}
+
+void Cpu::set_profiler(Profiler* newProfiler)
+{
+    profiler = newProfiler;
+}
+
+void Cpu::set_tracer(Tracer* newTracer)
+{
+    tracer = newTracer;
+}
+
+void Cpu::set_timing_model(TimingModel* model)
+{
+    timingModel = model;
+}
+
+void Cpu::set_error_stream(std::ostream* out)
+{
+    errorStream = out;
+}
+
+// Called once per original instruction before it runs, for the second half of a
+// superinstruction by instrumentRetire of the first.
+void Cpu::instrumentBegin(std::size_t address)
+{
+    if (profiler != nullptr) {
+        profiler->begin(address, program->instructions[address].opcode);
+    }
+    if (tracer != nullptr || timingModel != nullptr) {
+        accessAddress = memoryOperand(program->instructions[address]);
+    }
+}
+
+// The cell inst loads or stores, -1 for none. Taken before inst runs, since an
+// indirect base can be the register it overwrites; out of range means it won't retire.
+int Cpu::memoryOperand(const Instruction& inst) const
+{
+    for (const Operand* operand : { &inst.dst, &inst.src }) {
+        if (operand->kind == OperandKind::Memory) {
+            return operand->value;
+        }
+        if (operand->kind == OperandKind::Indirect) {
+            return wrap(static_cast<long long>(registerValue(operand->base)) + operand->value);
         }
+    }
+    return -1;
+}
 
-        else if (operation == "JG") {
-            std::string label;
-            iss >> label;
-            int address = findLabelAddress(label);
-            if (address == -1) {
-                std::cerr << "Label not found\n";
-                smthWentWrong = true;
-                return;
-            }
-            else {
-                labels[address] = label;
-                std::size_t firstSpace = memory[address].find(' ');
-                if (firstSpace != std::string::npos) {
-                    memory[address] = memory[address].substr(firstSpace + 1);
-                    if (registers["DA"] == 1) {
-                        registers["GH"] = address;
-                        continue;
-                    }
-                }
-                else {
-                    smthWentWrong = true;
-                    return;
-                }
-            }
+// Called once per original instruction after it took effect and before GH moves on,
+// so superinstructions report both halves.
+void Cpu::instrumentRetire(std::size_t address)
+{
+    const Instruction& inst = program->instructions[address];
+    bool jump = inst.opcode == Opcode::JMP
+        || (inst.opcode == Opcode::JG && taken<Opcode::JG>())
+        || (inst.opcode == Opcode::JL && taken<Opcode::JL>())
+        || (inst.opcode == Opcode::JE && taken<Opcode::JE>());
+    if (profiler != nullptr && (inst.opcode == Opcode::JG || inst.opcode == Opcode::JL || inst.opcode == Opcode::JE)) {
+        profiler->branch(inst.opcode, jump);
+    }
+    if (timingModel != nullptr) {
+        timingModel->retire(address, inst, accessAddress, jump);
+    }
+    if (tracer != nullptr) {
+        materialize();
+        Operand changed;
+        if (inst.opcode == Opcode::CMP) {
+            changed.kind = OperandKind::Register;
+            changed.value = static_cast<int>(Register::DA);
+        }
+        else if (inst.dst.kind == OperandKind::Register || inst.dst.kind == OperandKind::Memory) {
+            changed = inst.dst;
+        }
+        else if (inst.dst.kind == OperandKind::Indirect) {
+            // the store went through, so the address is valid
+            changed.kind = OperandKind::Memory;
+            changed.value = accessAddress;
         }
+        int value = 0;
+        if (changed.kind == OperandKind::Register) {
+            value = registers[changed.value];
+        }
+        else if (changed.kind == OperandKind::Memory) {
+            value = cell(changed.value);
+        }
+        tracer->record(address, inst, changed, value);
+    }
+    // the second half of a superinstruction addresses memory with what the first left
+    if (isSuperinstruction(program->code[address].opcode)) {
+        instrumentBegin(address + 1);
+    }
+}
 
-        else if (operation == "JL") {
-            std::string label;
-            iss >> label;
-            int address = findLabelAddress(label);
-            if (address == -1) {
-                std::cerr << "Label not found\n";
-                smthWentWrong = true;
+template <bool instrumented>
+void Cpu::runSwitch()
+{
+    int& gh = reg(Register::GH);
+    const Instruction* code = program->code.data();
+    while (static_cast<std::size_t>(gh) < instSize && retired < stepLimit) {
+        const Instruction& inst = code[gh];
+        // the instruction's own address, GH may be what it writes
+        std::size_t at = static_cast<std::size_t>(gh);
+        bool ok = true;
+        bool jump = false;
+        ++retired;
+        if constexpr (instrumented) {
+            instrumentBegin(at);
+        }
+
+        switch (inst.opcode) {
+        case Opcode::MOV: ok = alu<Opcode::MOV>(inst); break;
+        case Opcode::ADD: ok = alu<Opcode::ADD>(inst); break;
+        case Opcode::SUB: ok = alu<Opcode::SUB>(inst); break;
+        case Opcode::MUL: ok = alu<Opcode::MUL>(inst); break;
+        case Opcode::DIV: ok = alu<Opcode::DIV>(inst); break;
+        case Opcode::AND: ok = alu<Opcode::AND>(inst); break;
+        case Opcode::OR: ok = alu<Opcode::OR>(inst); break;
+        case Opcode::NOT: ok = alu<Opcode::NOT>(inst); break;
+        case Opcode::CMP: ok = alu<Opcode::CMP>(inst); break;
+        case Opcode::CAS: ok = atomicAlu<Opcode::CAS>(inst); break;
+        case Opcode::XADD: ok = atomicAlu<Opcode::XADD>(inst); break;
+        case Opcode::FENCE: ok = atomicAlu<Opcode::FENCE>(inst); break;
+
+        case Opcode::JMP: jump = true; break;
+        case Opcode::JG: jump = taken<Opcode::JG>(); break;
+        case Opcode::JL: jump = taken<Opcode::JL>(); break;
+        case Opcode::JE: jump = taken<Opcode::JE>(); break;
+
+        // superinstructions run their first half here and leave GH on the second
+        case Opcode::CMP_JG:
+        case Opcode::CMP_JL:
+        case Opcode::CMP_JE:
+            ++retired;
+            if (!alu<Opcode::CMP>(inst)) {
                 return;
             }
-            else {
-                labels[address] = label;
-                std::size_t firstSpace = memory[address].find(' ');
-                if (firstSpace != std::string::npos) {
-                    memory[address] = memory[address].substr(firstSpace + 1);
-                    if (registers["DA"] == -1) {
-                        registers["GH"] = address;
-                        continue;
-                    }
-                }
-                else {
-                    smthWentWrong = true;
-                    return;
-                }
+            if constexpr (instrumented) {
+                instrumentRetire(at);
             }
-        }
-
-        else if (operation == "JE") {
-            std::string label;
-            iss >> label;
-            int address = findLabelAddress(label);
-            if (address == -1) {
-                std::cerr << "Label not found\n";
-                smthWentWrong = true;
+            at = ++gh;
+            jump = inst.opcode == Opcode::CMP_JG ? taken<Opcode::JG>()
+                : inst.opcode == Opcode::CMP_JL ? taken<Opcode::JL>()
+                : taken<Opcode::JE>();
+            break;
+        case Opcode::MOV_ADD:
+            ++retired;
+            if (!alu<Opcode::MOV>(inst)) {
                 return;
             }
-            else {
-                labels[address] = label;
-                std::size_t firstSpace = memory[address].find(' ');
-                if (firstSpace != std::string::npos) {
-                    memory[address] = memory[address].substr(firstSpace + 1);
-                    if (registers["DA"] == 0) {
-                        registers["GH"] = address;
-                        continue;
-                    }
-                }
-                else {
-                    smthWentWrong = true;
-                    return;
-                }
+            if constexpr (instrumented) {
+                instrumentRetire(at);
             }
+            at = ++gh;
+            ok = alu<Opcode::ADD>(code[gh]);
+            break;
+        default:
+            break;
         }
 
-        else {
-            std::cerr << "Incorrect instruction provided\n";
-            smthWentWrong = true;
+        if (!ok) {
             return;
         }
+        if constexpr (instrumented) {
+            instrumentRetire(at);
+        }
+        gh = jump ? code[gh].dst.value : nextAddress(gh);
+    }
+}
 
-        registers["GH"]++;
+// Direct-threaded dispatch: every instruction is translated to the address of its
+// handler and each handler jumps straight to the next one (GCC/Clang computed goto).
+template <bool instrumented>
+void Cpu::runThreaded()
+{
+#if defined(__GNUC__)
+    static const void* const handlers[] = {
+        &&op_MOV, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_AND, &&op_OR,
+        &&op_NOT, &&op_CMP, &&op_JMP, &&op_JG, &&op_JL, &&op_JE,
+        &&op_CAS, &&op_XADD, &&op_FENCE,
+        &&op_CMP_JG, &&op_CMP_JL, &&op_CMP_JE, &&op_MOV_ADD
+    };
+    // each instantiation has its own handlers, rebuild when switching between them
+    const Instruction* code = program->code.data();
+    if (threadedHandlers != handlers || threadedCode.size() != instSize) {
+        threadedHandlers = handlers;
+        threadedCode.resize(instSize);
+        for (std::size_t i = 0; i < instSize; ++i) {
+            threadedCode[i] = handlers[static_cast<std::size_t>(code[i].opcode)];
+        }
+    }
+    int& gh = reg(Register::GH);
+    [[maybe_unused]] std::size_t at = 0; // address of the running instruction, GH may be what it writes
+
+#define CPU_DISPATCH() \
+    do { \
+        if (static_cast<std::size_t>(gh) >= instSize || retired >= stepLimit) { \
+            return; \
+        } \
+        ++retired; \
+        if constexpr (instrumented) { \
+            at = static_cast<std::size_t>(gh); \
+            instrumentBegin(at); \
+        } \
+        goto *threadedCode[gh]; \
+    } while (0)
+#define CPU_RETIRE() \
+    if constexpr (instrumented) { \
+        instrumentRetire(at); \
+    }
+#define CPU_SECOND_HALF() \
+    ++gh; \
+    if constexpr (instrumented) { \
+        at = static_cast<std::size_t>(gh); \
+    }
+#define CPU_ALU(op) \
+    if (!alu<op>(code[gh])) { \
+        return; \
+    } \
+    CPU_RETIRE() \
+    gh = nextAddress(gh); \
+    CPU_DISPATCH()
+#define CPU_ATOMIC(op) \
+    if (!atomicAlu<op>(code[gh])) { \
+        return; \
+    } \
+    CPU_RETIRE() \
+    ++gh; \
+    CPU_DISPATCH()
+#define CPU_BRANCH(op) \
+    CPU_RETIRE() \
+    gh = taken<op>() ? code[gh].dst.value : gh + 1; \
+    CPU_DISPATCH()
+#define CPU_CMP_BRANCH(op) \
+    ++retired; \
+    if (!alu<Opcode::CMP>(code[gh])) { \
+        return; \
+    } \
+    CPU_RETIRE() \
+    CPU_SECOND_HALF() \
+    CPU_BRANCH(op)
+
+    CPU_DISPATCH();
+op_MOV: CPU_ALU(Opcode::MOV);
+op_ADD: CPU_ALU(Opcode::ADD);
+op_SUB: CPU_ALU(Opcode::SUB);
+op_MUL: CPU_ALU(Opcode::MUL);
+op_DIV: CPU_ALU(Opcode::DIV);
+op_AND: CPU_ALU(Opcode::AND);
+op_OR: CPU_ALU(Opcode::OR);
+op_NOT: CPU_ALU(Opcode::NOT);
+op_CMP: CPU_ALU(Opcode::CMP);
+op_JMP: CPU_BRANCH(Opcode::JMP);
+op_JG: CPU_BRANCH(Opcode::JG);
+op_JL: CPU_BRANCH(Opcode::JL);
+op_JE: CPU_BRANCH(Opcode::JE);
+op_CAS: CPU_ATOMIC(Opcode::CAS);
+op_XADD: CPU_ATOMIC(Opcode::XADD);
+op_FENCE: CPU_ATOMIC(Opcode::FENCE);
+op_CMP_JG: CPU_CMP_BRANCH(Opcode::JG);
+op_CMP_JL: CPU_CMP_BRANCH(Opcode::JL);
+op_CMP_JE: CPU_CMP_BRANCH(Opcode::JE);
+op_MOV_ADD:
+    ++retired;
+    if (!alu<Opcode::MOV>(code[gh])) {
+        return;
+    }
+    CPU_RETIRE()
+    CPU_SECOND_HALF()
+    CPU_ALU(Opcode::ADD);
+
+#undef CPU_CMP_BRANCH
+#undef CPU_BRANCH
+#undef CPU_ATOMIC
+#undef CPU_ALU
+#undef CPU_SECOND_HALF
+#undef CPU_RETIRE
+#undef CPU_DISPATCH
+#else
+    // no computed goto on this compiler
+    runSwitch<instrumented>();
+#endif
+}
+
+void Cpu::runJit()
+{
+    // the generated code stores straight into the cells, so every page has to be this Cpu's own
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        pageTable[i] = &writableCell(i * pageCells);
+    }
+    materialize(); // the generated code keeps DA and ZA up to date itself
+    JitCode::Context context;
+    context.registers = registers;
+    context.retired = retired;
+    context.stepLimit = stepLimit;
+    context.pages = pageTable.data();
+
+    JitCode::Exit exit = jitCode->run(context);
+    registers = context.registers;
+    retired = context.retired;
+    switch (exit) {
+    case JitCode::Exit::DivideByZero:
+        error("Can't divide by zero");
+        break;
+    case JitCode::Exit::BelowData:
+        checkAddress(-1);
+        break;
+    case JitCode::Exit::AboveMemory:
+        checkAddress(static_cast<int>(memorySize));
+        break;
+    default:
+        break;
     }
 }
 
 void Cpu::clear() 
 {
-    registers["GH"] = 0;
-    for (auto& reg : registers) {
-        if (reg.first != "GH") {
-            reg.second = 0;
+    registers.fill(0);
+    lazyRegisters = 0;
+    resetMemory();
+    program = std::make_shared<const Program>();
+    threadedCode.clear();
+    threadedHandlers = nullptr;
+    jitCode.reset();
+    symbols.clear();
+    instSize = 0;
+    retired = 0;
+    smthWentWrong = false;
+    errorMessage.clear();
+}
+
+void Cpu::error(const std::string& message)
+{
+    if (errorStream != nullptr) {
+        *errorStream << message << '\n';
+    }
+    errorMessage = message;
+    smthWentWrong = true;
+}
+
+// Copy-on-write: a page shared with a fork is copied before the first store to it
+int& Cpu::writableCell(std::size_t address)
+{
+    std::size_t page = address / pageCells;
+    if (!pageOwned[page]) {
+        if (pages[page].use_count() != 1) {
+            pages[page] = std::make_shared<Page>(*pages[page]);
         }
+        // the other owners are done with this page once the count dropped to one
+        std::atomic_thread_fence(std::memory_order_acquire);
+        pageOwned[page] = 1;
     }
-    instSize = 0;
+    return pages[page]->cells[address % pageCells];
+}
+
+const std::shared_ptr<Cpu::Page>& Cpu::zeroPage()
+{
+    static const std::shared_ptr<Page> page = std::make_shared<Page>();
+    return page;
+}
+
+// Zeroes pages this Cpu owns in place and gives it its own copy of every other one,
+// so the run that follows never allocates. Only a fork writing to a shared page does.
+void Cpu::resetMemory()
+{
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        if (pageOwned[i]) {
+            pages[i]->cells.fill(0);
+        }
+        else {
+            pages[i] = std::make_shared<Page>();
+            pageOwned[i] = 1;
+        }
+    }
+}
+
+Cpu Cpu::fork()
+{
+    std::fill(pageOwned.begin(), pageOwned.end(), 0);
+    Cpu child(engine, memorySize);
+    child.registers = registers;
+    child.flags = flags;
+    child.lazyRegisters = lazyRegisters;
+    child.pages = pages;
+    child.program = program;
+    child.threadedCode = threadedCode;
+    child.threadedHandlers = threadedHandlers;
+    child.jitCode = jitCode;
+    child.symbols = symbols;
+    child.instSize = instSize;
+    child.retired = retired;
+    child.smthWentWrong = smthWentWrong;
+    child.errorMessage = errorMessage;
+    child.errorStream = errorStream;
+    return child;
+}
+
+Cpu Cpu::share_memory()
+{
+    // pages still shared with a fork are copied first, from here on both sides own them all
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        writableCell(i * pageCells);
+    }
+    Cpu core = fork();
+    std::fill(pageOwned.begin(), pageOwned.end(), 1);
+    std::fill(core.pageOwned.begin(), core.pageOwned.end(), 1);
+    return core;
+}
+
+int Cpu::read_register(Register r) const
+{
+    return registerValue(r);
+}
+
+void Cpu::write_register(Register r, int value)
+{
+    lazyRegisters &= static_cast<std::uint8_t>(~(1u << static_cast<unsigned>(r)));
+    reg(r) = value;
+}
+
+int Cpu::registerValue(Register r) const
+{
+    if (lazyRegisters & (1u << static_cast<unsigned>(r))) {
+        if (r == Register::DA) {
+            return compareResult(flags.compareLeft, flags.compareRight);
+        }
+        long long exact = exactResult(flags.arithmetic, flags.arithmeticLeft, flags.arithmeticRight);
+        return exact != wrap(exact) ? 1 : 0;
+    }
+    return registers[static_cast<std::size_t>(r)];
+}
+
+void Cpu::materialize()
+{
+    reg(Register::DA) = registerValue(Register::DA);
+    reg(Register::ZA) = registerValue(Register::ZA);
+    lazyRegisters = 0;
+}
+
+int Cpu::read_memory(std::size_t address) const
+{
+    return address < memorySize ? cell(address) : 0;
+}
+
+std::size_t Cpu::memory_size() const
+{
+    return memorySize;
+}
+
+std::uint64_t Cpu::instructions_retired() const
+{
+    return retired;
+}
+
+bool Cpu::failed() const
+{
+    return smthWentWrong;
+}
+
+const std::string& Cpu::error_message() const
+{
+    return errorMessage;
+}
+
+const std::vector<Instruction>& Cpu::instructions() const
+{
+    return program->instructions;
+}
+
+namespace {
+
+const char snapshotMagic[8] = { 'C', 'P', 'U', 'S', 'N', 'A', 'P', ' ' };
+const std::uint32_t snapshotVersion = 1;
+
+// followed by registerCount registers and memorySize - instSize data cells, all int32
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t registerCount;
+    std::uint32_t memorySize;
+    std::uint32_t instSize;
+    std::uint64_t programHash; // restore refuses a different program
+    std::uint64_t retired;
+};
+
+}
+
+// FNV-1a over the decoded instructions, field by field so padding stays out of it
+std::uint64_t Cpu::programHash() const
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](std::uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 1099511628211ull;
+        }
+    };
+    for (const Instruction& inst : program->instructions) {
+        mix(static_cast<std::uint32_t>(inst.opcode));
+        mix(packKind(inst.dst));
+        mix(static_cast<std::uint32_t>(inst.dst.value));
+        mix(packKind(inst.src));
+        mix(static_cast<std::uint32_t>(inst.src.value));
+    }
+    return hash;
+}
+
+std::vector<std::uint8_t> Cpu::snapshot() const
+{
+    std::vector<std::uint8_t> blob;
+    if (smthWentWrong) {
+        return blob;
+    }
+    SnapshotHeader header;
+    std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.registerCount = static_cast<std::uint32_t>(registerCount);
+    header.memorySize = static_cast<std::uint32_t>(memorySize);
+    header.instSize = static_cast<std::uint32_t>(instSize);
+    header.programHash = programHash();
+    header.retired = retired;
+
+    std::size_t dataCells = memorySize - instSize;
+    blob.resize(sizeof(header) + (registerCount + dataCells) * sizeof(std::int32_t));
+    std::uint8_t* out = blob.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    static_assert(sizeof(int) == sizeof(std::int32_t), "snapshot cells are int32");
+    for (std::size_t r = 0; r < registerCount; ++r) {
+        std::int32_t value = registerValue(static_cast<Register>(r));
+        std::memcpy(out, &value, sizeof(value));
+        out += sizeof(value);
+    }
+    for (std::size_t i = instSize; i < memorySize; ++i) {
+        std::int32_t value = cell(i);
+        std::memcpy(out, &value, sizeof(value));
+        out += sizeof(value);
+    }
+    return blob;
+}
+
+bool Cpu::restore(const std::vector<std::uint8_t>& blob)
+{
+    SnapshotHeader header;
+    if (blob.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, blob.data(), sizeof(header));
+    if (std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0
+        || header.version != snapshotVersion || header.registerCount != registerCount
+        || header.memorySize != memorySize || header.instSize != instSize
+        || header.programHash != programHash()) {
+        return false;
+    }
+    std::size_t dataCells = memorySize - instSize;
+    if (blob.size() != sizeof(header) + (registerCount + dataCells) * sizeof(std::int32_t)) {
+        return false;
+    }
+
+    const std::uint8_t* in = blob.data() + sizeof(header);
+    std::memcpy(registers.data(), in, registerCount * sizeof(std::int32_t));
+    lazyRegisters = 0;
+    in += registerCount * sizeof(std::int32_t);
+    for (std::size_t i = instSize; i < memorySize; ++i) {
+        std::int32_t value;
+        std::memcpy(&value, in, sizeof(value));
+        in += sizeof(value);
+        if (cell(i) != value) {
+            writableCell(i) = value;
+        }
+    }
+    retired = header.retired;
     smthWentWrong = false;
+    errorMessage.clear();
+    return true;
+}
+
+bool Cpu::save_snapshot(const std::string& path) const
+{
+    std::vector<std::uint8_t> blob = snapshot();
+    if (blob.empty()) {
+        return false;
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+    return static_cast<bool>(out);
+}
+
+bool Cpu::load_snapshot(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::vector<std::uint8_t> blob((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return restore(blob);
 }
 
 void Cpu::dump_memory() const
@@ -770,13 +1416,16 @@ void Cpu::dump_memory() const
     }
     std::cout << "Memory:\n";
     for (std::size_t i = 0; i < memorySize; ++i) {
-        auto labelIt = labels.find(i);
-        if (labelIt != labels.end()) {
-            std::cout << "[" << i << "] : ";
-            std::cout << labelIt->second << ": " << memory[i] << std::endl;
+        std::cout << "[" << i << "] : ";
+        if (i < instSize) {
+            auto labelIt = program->labels.find(static_cast<int>(i));
+            if (labelIt != program->labels.end()) {
+                std::cout << labelIt->second << ": ";
+            }
+            std::cout << program->text[i] << std::endl;
         }
         else {
-            std::cout << "[" << i << "] : " << memory[i] << std::endl;
+            std::cout << cell(i) << std::endl;
         }
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
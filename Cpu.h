@@ -1,28 +1,167 @@
 #pragma once
 #include <vector>
+#include <array>
 #include <map>
 #include <string>
+#include <iosfwd>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include "Instruction.h"
+#include "Program.h"
+
+class Profiler;
+class Tracer;
+class TimingModel;
+class JitCode;
 
 
 class Cpu
 {
 public:
-	Cpu();
+	// how execute dispatches decoded instructions
+	enum class Engine
+	{
+		Switch,   // switch statement, portable baseline
+		Threaded, // computed goto on GCC/Clang, falls back to Switch elsewhere
+		Jit       // native x86-64 code (Jit.h), Threaded where that can't translate the program and while instrumented
+	};
+
+	enum class RunStatus
+	{
+		Halted,          // GH left the program
+		BudgetExhausted, // maxSteps instructions ran, call run again to resume
+		Error
+	};
+
+	static constexpr std::size_t defaultMemorySize = 32;
+	static constexpr std::size_t maxMemorySize = 65536;
+
+	// memorySize cells, instructions included, clamped to [1, maxMemorySize]
+	explicit Cpu(Engine engine = Engine::Threaded, std::size_t memorySize = defaultMemorySize);
+	Cpu(Cpu&&) = default;
+	Cpu(const Cpu&) = delete; // copies share memory pages, use fork
+	Cpu& operator=(const Cpu&) = delete;
 
 public:
-	void load(const std::string& file);
-	void execute(const std::string& file);
+	// Every load starts from a cleared Cpu: registers, memory, retired count and a
+	// previous error are reset, profiler, tracer and timing model stay attached.
+	void load(const std::string& file); // source text, or an object written by save_object
+	void load(std::istream& in);
+	void load_object(const std::string& file);
+	void load_object(const std::uint8_t* data, std::size_t size); // an object already in memory
+	void load(std::shared_ptr<const Program> program); // shared, e.g. from ProgramCache, decoded for at most memory_size cells
+	std::shared_ptr<const Program> loaded_program() const;
+	bool save_object(const std::string& file) const; // the loaded program and its non-zero data cells, see Object.h
+	RunStatus execute(const std::string& file, std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max());
+	RunStatus execute(std::istream& in, std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max());
+	// Runs the loaded program from the current GH for at most maxSteps instructions.
+	// A superinstruction is never split, so a slice may overrun the budget by one.
+	RunStatus run(std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max());
+	void set_profiler(Profiler* profiler); // not owned, nullptr turns profiling off
+	void set_tracer(Tracer* tracer);       // not owned, nullptr turns tracing off
+	void set_timing_model(TimingModel* model); // not owned, nullptr turns cycle estimates off
+	void set_error_stream(std::ostream* out);  // not owned, std::cerr by default, nullptr keeps errors to error_message
 	void dump_memory() const;
+	int read_register(Register r) const;
+	void write_register(Register r, int value); // GH included, the next run starts there
+	int read_memory(std::size_t address) const;
+	std::size_t memory_size() const;
+	std::uint64_t instructions_retired() const; // since the last clear, a superinstruction counts as two
+	bool failed() const;
+	const std::string& error_message() const;
+	const std::vector<Instruction>& instructions() const; // decoded, before fusion
 	void clear();
 
+	// Registers (GH included), data memory and the retired count as a flat blob.
+	// A snapshot only restores into a Cpu that has the same program loaded; on
+	// mismatch or a malformed blob restore returns false and changes nothing.
+	// Empty when the Cpu has failed.
+	std::vector<std::uint8_t> snapshot() const;
+	bool restore(const std::vector<std::uint8_t>& blob);
+	bool save_snapshot(const std::string& path) const;
+	bool load_snapshot(const std::string& path);
+
+	// A Cpu in the same state that shares the program and memory pages with this
+	// one. Either side copies a page the first time it writes to it, so forking
+	// costs a page table, not the memory. Profiler, tracer and timing model are not
+	// carried over. Those copies are the only allocations run makes; without a fork or
+	// instrumentation a loaded program runs without touching the heap.
+	Cpu fork();
+
+	// Another core of the same machine: a Cpu in the same state whose loads and stores
+	// go to the very same pages as this one's, nothing is ever copied. The two may run
+	// on different threads; CAS, XADD and FENCE are what orders their accesses (see
+	// MultiCore.h). load or clear on either side resets the memory both of them see.
+	Cpu share_memory();
+
 private:
-	int findLabelAddress(const std::string& label);
+	void error(const std::string& message);
+	bool decode(const std::string& line, Instruction& inst);
+	bool decodeOperand(const std::string& token, Operand& operand);
+	bool readOperand(const Operand& operand, int& value);
+	bool writeOperand(const Operand& operand, int value);
+	bool checkAddress(int memAddress);
+	bool checkAddresses(const Instruction& inst);
+	bool indirectAddress(const Operand& operand, int& address);
+	template <Opcode op> bool alu(const Instruction& inst);
+	template <Opcode op> bool atomicAlu(const Instruction& inst);
+	template <Opcode op> bool taken();
+	void fuse(Program& loaded);
+	std::uint64_t programHash() const;
+	void instrumentBegin(std::size_t address);
+	void instrumentRetire(std::size_t address);
+	int memoryOperand(const Instruction& inst) const;
+	template <bool instrumented> void runSwitch();
+	template <bool instrumented> void runThreaded();
+	void runJit();
+	void prepareRun();
+	int& reg(Register r) { return registers[static_cast<std::size_t>(r)]; }
+	int registerValue(Register r) const; // flags included, for readers that can't materialize
+	void materialize();
+	int cell(std::size_t address) const { return pages[address / pageCells]->cells[address % pageCells]; }
+	int& writableCell(std::size_t address);
+	void resetMemory();
 
 private:
-	const std::size_t memorySize = 32;
-	std::map<std::string, int> registers;
-	std::vector<std::string> memory;
+	const Engine engine;
+	const std::size_t memorySize;
+	static constexpr std::size_t pageCells = 256;
+	struct Page
+	{
+		std::array<int, pageCells> cells{};
+	};
+	static const std::shared_ptr<Page>& zeroPage(); // what memory is before the first load
+	std::array<int, registerCount> registers;
+	// Flags are recorded, not computed: CMP keeps its operands for DA and ADD/SUB/MUL/DIV
+	// keep theirs for ZA. A register with its bit set in lazyRegisters is out of date until
+	// something reads it; most flag writes are overwritten unread.
+	struct LazyFlags
+	{
+		int compareLeft = 0;
+		int compareRight = 0;
+		Opcode arithmetic = Opcode::ADD;
+		int arithmeticLeft = 0;
+		int arithmeticRight = 0;
+	};
+	LazyFlags flags;
+	std::uint8_t lazyRegisters = 0;
+	std::vector<std::shared_ptr<Page>> pages; // memory, pages may be shared with forks
+	std::vector<std::uint8_t> pageOwned;      // set once this Cpu holds the only reference to the page
+	std::shared_ptr<const Program> program;
+	std::vector<const void*> threadedCode; // handler address per instruction, built on first threaded run into space reserved by load
+	const void* const* threadedHandlers = nullptr; // handler table threadedCode was built from
+	std::shared_ptr<const JitCode> jitCode; // compiled by load for Engine::Jit, shared with forks
+	std::vector<int*> pageTable;            // cells of every page, handed to jitCode
+	std::map<std::string, int> symbols; // label -> instruction address
 	std::size_t instSize;
-	std::map<int, std::string> labels;
+	std::uint64_t retired;
+	std::uint64_t stepLimit; // value of retired at which the current run stops
+	Profiler* profiler;
+	Tracer* tracer;
+	TimingModel* timingModel;
+	int accessAddress; // cell the instruction being instrumented uses, found before it ran
 	bool smthWentWrong;
-};
\ No newline at end of file
+	std::string errorMessage;
+	std::ostream* errorStream;
+};
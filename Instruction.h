@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+enum class Opcode : std::uint8_t
+{
+	MOV,
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	AND,
+	OR,
+	NOT,
+	CMP,
+	JMP,
+	JG,
+	JL,
+	JE,
+	CAS,   // CAS [m] , src: [m] = src if [m] == AYB, AYB gets the old [m]; one atomic step
+	XADD,  // XADD [m] , src: [m] += src, AYB gets the old [m]; one atomic step
+	FENCE, // no operand, orders the memory accesses around it for the other cores
+
+	// superinstructions, only produced by Cpu::fuse
+	CMP_JG,  // CMP followed by JG
+	CMP_JL,  // CMP followed by JL
+	CMP_JE,  // CMP followed by JE
+	MOV_ADD, // MOV reg , imm followed by ADD
+	Count
+};
+
+constexpr std::size_t opcodeCount = static_cast<std::size_t>(Opcode::Count);
+
+// indexed by Opcode, used for reports
+inline constexpr const char* opcodeNames[opcodeCount] = {
+	"MOV", "ADD", "SUB", "MUL", "DIV", "AND", "OR", "NOT", "CMP", "JMP", "JG", "JL", "JE", "CAS", "XADD", "FENCE",
+	"CMP_JG", "CMP_JL", "CMP_JE", "MOV_ADD"
+};
+
+enum class Register : std::uint8_t
+{
+	AYB, // accumulator
+	BEN,
+	GIM,
+	DA,  // for CMP
+	ECH,
+	ZA,
+	GH,  // analogue of EIP
+	Count
+};
+
+constexpr std::size_t registerCount = static_cast<std::size_t>(Register::Count);
+
+// indexed by Register, used only when decoding and printing
+inline constexpr const char* registerNames[registerCount] = { "AYB", "BEN", "GIM", "DA", "ECH", "ZA", "GH" };
+
+enum class OperandKind : std::uint8_t
+{
+	None,
+	Register,  // value is a Register
+	Memory,    // value is a memory address
+	Immediate, // value is the literal itself
+	Label,     // value is the resolved instruction address
+	Indirect   // [REG] or [REG+imm], value is the offset added to base
+};
+
+struct Operand
+{
+	OperandKind kind = OperandKind::None;
+	Register base = Register::AYB; // Indirect only
+	int value = 0;
+};
+
+// How trace and object files store an operand kind: OperandKind in the low nibble,
+// the Indirect base register in the high one
+inline std::uint8_t packKind(const Operand& operand)
+{
+	return static_cast<std::uint8_t>(static_cast<unsigned>(operand.kind) | static_cast<unsigned>(operand.base) << 4);
+}
+
+inline void unpackKind(std::uint8_t packed, Operand& operand)
+{
+	operand.kind = static_cast<OperandKind>(packed & 0xf);
+	operand.base = static_cast<Register>(packed >> 4);
+}
+
+// One source line decoded once at load time
+struct Instruction
+{
+	Opcode opcode = Opcode::MOV;
+	std::uint8_t flagOperands = 0; // 1 << DA / ZA when an operand uses that flag register, set by Cpu::fuse
+	Operand dst;
+	Operand src;
+};
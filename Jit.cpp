@@ -0,0 +1,673 @@
+#include "Jit.h"
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define CPU_HAVE_JIT 1
+#endif
+
+#if defined(CPU_HAVE_JIT)
+
+namespace {
+
+enum HostRegister : int
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Simulated register -> host register for the whole run. GH has none, it is known
+// statically at every instruction. R12 holds retired, R13 the step limit, RSI the
+// Context and RDI the page table; RAX, RCX and RDX are scratch.
+constexpr int pinned[registerCount] = { R8, R9, R10, R11, RBX, RBP, -1 };
+
+constexpr std::uint8_t condOverflow = 0x0;
+constexpr std::uint8_t condEqual = 0x4;
+constexpr std::uint8_t condNotEqual = 0x5;
+constexpr std::uint8_t condAboveEqual = 0x3;
+constexpr std::uint8_t condLess = 0xc;
+constexpr std::uint8_t condGreaterEqual = 0xd;
+
+// where an operand lives when its instruction runs
+struct Location
+{
+    enum Kind { Reg, Imm, Mem } kind = Imm;
+    int reg = 0;            // the register, or the base register for Mem
+    int index = -1;         // Mem only, -1 for none
+    int scale = 1;          // of index
+    std::int32_t value = 0; // the immediate, or the displacement for Mem
+};
+
+Location reg(int r)
+{
+    Location location;
+    location.kind = Location::Reg;
+    location.reg = r;
+    return location;
+}
+
+Location imm(std::int32_t value)
+{
+    Location location;
+    location.value = value;
+    return location;
+}
+
+Location mem(int base, std::int32_t displacement, int index = -1, int scale = 1)
+{
+    Location location;
+    location.kind = Location::Mem;
+    location.reg = base;
+    location.value = displacement;
+    location.index = index;
+    location.scale = scale;
+    return location;
+}
+
+// Just the x86-64 encodings the translation needs. Memory operands always use a
+// 32-bit displacement, so RBP/R13 need no special casing; RSP/R12 are never a base.
+class Assembler
+{
+public:
+    int label()
+    {
+        labels.push_back(-1);
+        return static_cast<int>(labels.size() - 1);
+    }
+
+    void bind(int label)
+    {
+        labels[label] = static_cast<std::ptrdiff_t>(bytes.size());
+    }
+
+    void byte(std::uint8_t b)
+    {
+        bytes.push_back(b);
+    }
+
+    void dword(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // opcode with a ModRM byte: reg is a register or an opcode extension, rm a Reg or Mem location
+    void op(std::initializer_list<std::uint8_t> opcode, int r, const Location& rm, bool wide = false)
+    {
+        int index = rm.kind == Location::Mem ? rm.index : -1;
+        std::uint8_t rex = (wide ? 8 : 0) | ((r & 8) ? 4 : 0) | (index >= 0 && (index & 8) ? 2 : 0) | ((rm.reg & 8) ? 1 : 0);
+        if (rex != 0) {
+            byte(0x40 | rex);
+        }
+        for (std::uint8_t b : opcode) {
+            byte(b);
+        }
+        if (rm.kind == Location::Reg) {
+            byte(static_cast<std::uint8_t>(0xc0 | (r & 7) << 3 | (rm.reg & 7)));
+            return;
+        }
+        if (index >= 0) {
+            std::uint8_t scaleBits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            byte(static_cast<std::uint8_t>(0x80 | (r & 7) << 3 | 4));
+            byte(static_cast<std::uint8_t>(scaleBits << 6 | (index & 7) << 3 | (rm.reg & 7)));
+        }
+        else {
+            byte(static_cast<std::uint8_t>(0x80 | (r & 7) << 3 | (rm.reg & 7)));
+        }
+        dword(static_cast<std::uint32_t>(rm.value));
+    }
+
+    void movImm(int r, std::int32_t value)
+    {
+        if (r & 8) {
+            byte(0x41);
+        }
+        byte(static_cast<std::uint8_t>(0xb8 + (r & 7)));
+        dword(static_cast<std::uint32_t>(value));
+    }
+
+    void push(int r)
+    {
+        if (r & 8) {
+            byte(0x41);
+        }
+        byte(static_cast<std::uint8_t>(0x50 + (r & 7)));
+    }
+
+    void pop(int r)
+    {
+        if (r & 8) {
+            byte(0x41);
+        }
+        byte(static_cast<std::uint8_t>(0x58 + (r & 7)));
+    }
+
+    void jump(int target)
+    {
+        byte(0xe9);
+        rel32(target);
+    }
+
+    void jumpIf(std::uint8_t condition, int target)
+    {
+        byte(0x0f);
+        byte(static_cast<std::uint8_t>(0x80 | condition));
+        rel32(target);
+    }
+
+    // lea r64, [rip + label]
+    void leaLabel(int r, int target)
+    {
+        byte(static_cast<std::uint8_t>(0x48 | ((r & 8) ? 4 : 0)));
+        byte(0x8d);
+        byte(static_cast<std::uint8_t>((r & 7) << 3 | 5));
+        rel32(target);
+    }
+
+    // 32-bit offset of label from base, for the entry table
+    void offset(int target, int base)
+    {
+        tableFixups.emplace_back(bytes.size(), std::make_pair(target, base));
+        dword(0);
+    }
+
+    std::vector<std::uint8_t> finish()
+    {
+        for (const auto& fixup : fixups) {
+            std::ptrdiff_t rel = labels[fixup.second] - static_cast<std::ptrdiff_t>(fixup.first + 4);
+            patch(fixup.first, static_cast<std::uint32_t>(rel));
+        }
+        for (const auto& fixup : tableFixups) {
+            std::ptrdiff_t rel = labels[fixup.second.first] - labels[fixup.second.second];
+            patch(fixup.first, static_cast<std::uint32_t>(rel));
+        }
+        return bytes;
+    }
+
+private:
+    void rel32(int target)
+    {
+        fixups.emplace_back(bytes.size(), target);
+        dword(0);
+    }
+
+    void patch(std::size_t at, std::uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            bytes[at + i] = static_cast<std::uint8_t>(value >> (8 * i));
+        }
+    }
+
+private:
+    std::vector<std::uint8_t> bytes;
+    std::vector<std::ptrdiff_t> labels;
+    std::vector<std::pair<std::size_t, int>> fixups;
+    std::vector<std::pair<std::size_t, std::pair<int, int>>> tableFixups;
+};
+
+bool isSuperinstruction(Opcode op)
+{
+    return op == Opcode::CMP_JG || op == Opcode::CMP_JL || op == Opcode::CMP_JE || op == Opcode::MOV_ADD;
+}
+
+bool isJump(Opcode op)
+{
+    return op == Opcode::JMP || op == Opcode::JG || op == Opcode::JL || op == Opcode::JE;
+}
+
+// GH as a destination is a computed jump and GH as a base a computed address,
+// neither has a static translation
+bool supported(const Instruction& inst)
+{
+    auto isGh = [](const Operand& operand) {
+        return (operand.kind == OperandKind::Register && operand.value == static_cast<int>(Register::GH))
+            || (operand.kind == OperandKind::Indirect && operand.base == Register::GH);
+    };
+    if (isJump(inst.opcode)) {
+        return true;
+    }
+    if (inst.opcode == Opcode::CMP) {
+        return !(inst.dst.kind == OperandKind::Indirect && inst.dst.base == Register::GH)
+            && !(inst.src.kind == OperandKind::Indirect && inst.src.base == Register::GH);
+    }
+    return !isGh(inst.dst) && !(inst.src.kind == OperandKind::Indirect && inst.src.base == Register::GH);
+}
+
+class Translator
+{
+public:
+    Translator(const Program& program, std::size_t memorySize, int pageShift)
+        : program(program)
+        , instSize(program.instructions.size())
+        , memorySize(memorySize)
+        , pageShift(pageShift)
+        , epilogue(a.label())
+        , table(a.label())
+    {
+        for (std::size_t i = 0; i < instSize; ++i) {
+            entries.push_back(a.label());
+            bodies.push_back(a.label());
+        }
+    }
+
+    std::vector<std::uint8_t> translate()
+    {
+        prologue();
+        for (std::size_t i = 0; i < instSize; ++i) {
+            if (!secondHalf(i)) {
+                a.bind(entries[i]);
+                countStep(i, isSuperinstruction(program.code[i].opcode) ? 2 : 1);
+            }
+            a.bind(bodies[i]);
+            instruction(i);
+        }
+        a.jump(exitAt(instSize, JitCode::Exit::Done));
+
+        // jumps into the second half of a superinstruction dispatch it on its own
+        for (std::size_t i = 0; i < instSize; ++i) {
+            if (secondHalf(i)) {
+                a.bind(entries[i]);
+                countStep(i, 1);
+                a.jump(bodies[i]);
+            }
+        }
+        stubs();
+        return a.finish();
+    }
+
+private:
+    bool secondHalf(std::size_t i) const
+    {
+        return i > 0 && isSuperinstruction(program.code[i - 1].opcode);
+    }
+
+    static std::int32_t registerOffset(std::size_t r)
+    {
+        return static_cast<std::int32_t>(offsetof(JitCode::Context, registers) + r * sizeof(int));
+    }
+
+    void prologue()
+    {
+        a.push(RBX);
+        a.push(RBP);
+        a.push(R12);
+        a.push(R13);
+        a.op({ 0x89 }, RDI, reg(RSI), true); // mov rsi, rdi
+        a.op({ 0x8b }, RDI, mem(RSI, offsetof(JitCode::Context, pages)), true);
+        for (std::size_t r = 0; r < registerCount; ++r) {
+            if (pinned[r] >= 0) {
+                a.op({ 0x8b }, pinned[r], mem(RSI, registerOffset(r)));
+            }
+        }
+        a.op({ 0x8b }, R12, mem(RSI, offsetof(JitCode::Context, retired)), true);
+        a.op({ 0x8b }, R13, mem(RSI, offsetof(JitCode::Context, stepLimit)), true);
+
+        // resume at GH through the entry table, a GH outside the program halts at once
+        int outside = a.label();
+        a.op({ 0x8b }, RAX, mem(RSI, registerOffset(static_cast<std::size_t>(Register::GH))));
+        a.op({ 0x81 }, 7, reg(RAX));
+        a.dword(static_cast<std::uint32_t>(instSize));
+        a.jumpIf(condAboveEqual, outside);
+        a.leaLabel(RCX, table);
+        a.op({ 0x63 }, RDX, mem(RCX, 0, RAX, 4), true); // movsxd rdx, [rcx + rax*4]
+        a.op({ 0x01 }, RCX, reg(RDX), true);            // add rdx, rcx
+        a.op({ 0xff }, 4, reg(RDX));                    // jmp rdx
+        a.bind(outside);
+        a.op({ 0x31 }, RAX, reg(RAX)); // xor eax, eax: Done, GH untouched
+        a.jump(epilogue);
+    }
+
+    // the interpreters' dispatch check: stop with GH here once the budget is spent
+    void countStep(std::size_t i, std::uint8_t count)
+    {
+        a.op({ 0x39 }, R13, reg(R12), true); // cmp r12, r13
+        a.jumpIf(condAboveEqual, exitAt(i, JitCode::Exit::Done));
+        a.op({ 0x83 }, 0, reg(R12), true);   // add r12, count
+        a.byte(count);
+    }
+
+    // exit stub that stores GH and returns why; shared by every exit with the same pair
+    int exitAt(std::size_t gh, JitCode::Exit why)
+    {
+        auto key = std::make_pair(gh, why);
+        auto it = exits.find(key);
+        if (it != exits.end()) {
+            return it->second;
+        }
+        int stub = a.label();
+        exits.emplace(key, stub);
+        return stub;
+    }
+
+    int dispatch(int target)
+    {
+        return target >= 0 && static_cast<std::size_t>(target) < instSize
+            ? entries[target]
+            : exitAt(static_cast<std::size_t>(target), JitCode::Exit::Done);
+    }
+
+    // Emits whatever address computation the operand needs. Only one operand of an
+    // instruction can be in memory, so RAX/RCX are free for it.
+    Location locate(const Operand& operand, std::size_t i)
+    {
+        switch (operand.kind) {
+        case OperandKind::Register:
+            if (operand.value == static_cast<int>(Register::GH)) {
+                return imm(static_cast<std::int32_t>(i));
+            }
+            return reg(pinned[operand.value]);
+        case OperandKind::Memory: {
+            std::size_t address = static_cast<std::size_t>(operand.value);
+            a.op({ 0x8b }, RCX, mem(RDI, static_cast<std::int32_t>((address >> pageShift) * sizeof(int*))), true);
+            return mem(RCX, static_cast<std::int32_t>((address & ((std::size_t(1) << pageShift) - 1)) * sizeof(int)));
+        }
+        case OperandKind::Indirect: {
+            a.op({ 0x63 }, RAX, reg(pinned[static_cast<std::size_t>(operand.base)]), true); // movsxd rax, base
+            if (operand.value != 0) {
+                a.op({ 0x81 }, 0, reg(RAX), true);
+                a.dword(static_cast<std::uint32_t>(operand.value));
+            }
+            a.op({ 0x81 }, 7, reg(RAX), true);
+            a.dword(static_cast<std::uint32_t>(instSize));
+            a.jumpIf(condLess, exitAt(i, JitCode::Exit::BelowData));
+            a.op({ 0x81 }, 7, reg(RAX), true);
+            a.dword(static_cast<std::uint32_t>(memorySize));
+            a.jumpIf(condGreaterEqual, exitAt(i, JitCode::Exit::AboveMemory));
+            a.op({ 0x89 }, RAX, reg(RCX), true); // mov rcx, rax
+            a.op({ 0xc1 }, 5, reg(RCX), true);   // shr rcx, pageShift
+            a.byte(static_cast<std::uint8_t>(pageShift));
+            a.op({ 0x8b }, RCX, mem(RDI, 0, RCX, 8), true);
+            a.op({ 0x81 }, 4, reg(RAX));         // and eax, cells per page - 1
+            a.dword(static_cast<std::uint32_t>((1u << pageShift) - 1));
+            return mem(RCX, 0, RAX, 4);
+        }
+        default:
+            return imm(operand.value);
+        }
+    }
+
+    void load(int r, const Location& from)
+    {
+        if (from.kind == Location::Imm) {
+            a.movImm(r, from.value);
+        }
+        else {
+            a.op({ 0x8b }, r, from);
+        }
+    }
+
+    // ADD/SUB/AND/OR/MOV: forms are r/m,reg / reg,r/m / r/m,imm32 with extension
+    void arithmetic(std::uint8_t toRm, std::uint8_t toReg, std::uint8_t immOpcode, int extension,
+        const Location& dst, const Location& src)
+    {
+        if (src.kind == Location::Imm) {
+            if (dst.kind == Location::Reg && immOpcode == 0xc7) {
+                a.movImm(dst.reg, src.value);
+                return;
+            }
+            a.op({ immOpcode }, extension, dst);
+            a.dword(static_cast<std::uint32_t>(src.value));
+        }
+        else if (dst.kind == Location::Reg) {
+            a.op({ toReg }, dst.reg, src);
+        }
+        else {
+            a.op({ toRm }, src.reg, dst);
+        }
+    }
+
+    // ZA is set from the host overflow flag (or the byte in flag when setFlag is false)
+    // like the interpreters' lazy flags evaluate it, unless the instruction wrote ZA itself
+    void overflow(const Instruction& inst, int flag, bool setFlag)
+    {
+        if (inst.dst.kind == OperandKind::Register && inst.dst.value == static_cast<int>(Register::ZA)) {
+            return;
+        }
+        if (setFlag) {
+            a.op({ 0x0f, static_cast<std::uint8_t>(0x90 | condOverflow) }, 0, reg(flag)); // seto
+        }
+        a.op({ 0x0f, 0xb6 }, pinned[static_cast<std::size_t>(Register::ZA)], reg(flag)); // movzx
+    }
+
+    void instruction(std::size_t i)
+    {
+        const Instruction& inst = program.instructions[i];
+        switch (inst.opcode) {
+        case Opcode::JMP:
+            a.jump(dispatch(inst.dst.value));
+            return;
+        case Opcode::JG:
+            a.op({ 0x83 }, 7, reg(pinned[static_cast<std::size_t>(Register::DA)])); // cmp da, 1
+            a.byte(1);
+            a.jumpIf(condEqual, dispatch(inst.dst.value));
+            return;
+        case Opcode::JL:
+            a.op({ 0x83 }, 7, reg(pinned[static_cast<std::size_t>(Register::DA)])); // cmp da, -1
+            a.byte(0xff);
+            a.jumpIf(condEqual, dispatch(inst.dst.value));
+            return;
+        case Opcode::JE: {
+            int da = pinned[static_cast<std::size_t>(Register::DA)];
+            a.op({ 0x85 }, da, reg(da)); // test da, da
+            a.jumpIf(condEqual, dispatch(inst.dst.value));
+            return;
+        }
+        default:
+            break;
+        }
+
+        Location dst = locate(inst.dst, i);
+        Location src = inst.opcode == Opcode::NOT ? Location() : locate(inst.src, i);
+        switch (inst.opcode) {
+        case Opcode::MOV: arithmetic(0x89, 0x8b, 0xc7, 0, dst, src); break;
+        case Opcode::ADD:
+            arithmetic(0x01, 0x03, 0x81, 0, dst, src);
+            overflow(inst, RAX, true);
+            break;
+        case Opcode::OR: arithmetic(0x09, 0x0b, 0x81, 1, dst, src); break;
+        case Opcode::AND: arithmetic(0x21, 0x23, 0x81, 4, dst, src); break;
+        case Opcode::SUB:
+            arithmetic(0x29, 0x2b, 0x81, 5, dst, src);
+            overflow(inst, RAX, true);
+            break;
+        case Opcode::NOT:
+            a.op({ 0xf7 }, 2, dst);
+            break;
+        case Opcode::MUL:
+            // decode only allows a register destination
+            if (src.kind == Location::Imm) {
+                a.op({ 0x69 }, dst.reg, dst);
+                a.dword(static_cast<std::uint32_t>(src.value));
+            }
+            else {
+                a.op({ 0x0f, 0xaf }, dst.reg, src);
+            }
+            overflow(inst, RAX, true);
+            break;
+        case Opcode::DIV: {
+            // idiv faults on INT_MIN / -1, dividing by -1 is a negation that wraps instead
+            int divide = a.label();
+            int done = a.label();
+            load(RCX, src);
+            a.op({ 0x85 }, RCX, reg(RCX)); // test ecx, ecx
+            a.jumpIf(condEqual, exitAt(i, JitCode::Exit::DivideByZero));
+            a.op({ 0x8b }, RAX, dst);
+            a.op({ 0x83 }, 7, reg(RCX));   // cmp ecx, -1
+            a.byte(0xff);
+            a.jumpIf(condNotEqual, divide);
+            a.op({ 0xf7 }, 3, reg(RAX));   // neg eax
+            a.op({ 0x0f, 0x90 }, 0, reg(RDX)); // seto dl
+            a.jump(done);
+            a.bind(divide);
+            a.byte(0x99);                  // cdq
+            a.op({ 0xf7 }, 7, reg(RCX));   // idiv ecx
+            a.op({ 0x31 }, RDX, reg(RDX)); // xor edx, edx: no overflow
+            a.bind(done);
+            a.op({ 0x8b }, dst.reg, reg(RAX));
+            overflow(inst, RDX, false);
+            break;
+        }
+        case Opcode::CMP: {
+            // DA = sign of the wrapped difference, as the interpreters compute it
+            load(RDX, dst);
+            if (src.kind == Location::Imm) {
+                a.op({ 0x81 }, 5, reg(RDX));
+                a.dword(static_cast<std::uint32_t>(src.value));
+            }
+            else {
+                a.op({ 0x2b }, RDX, src);
+            }
+            a.op({ 0x85 }, RDX, reg(RDX));       // test edx, edx
+            a.op({ 0x0f, 0x9f }, 0, reg(RAX));   // setg al
+            a.op({ 0x0f, 0x9c }, 0, reg(RCX));   // setl cl
+            a.op({ 0x0f, 0xb6 }, RAX, reg(RAX)); // movzx eax, al
+            a.op({ 0x0f, 0xb6 }, RCX, reg(RCX)); // movzx ecx, cl
+            a.op({ 0x2b }, RAX, reg(RCX));       // sub eax, ecx
+            a.op({ 0x8b }, pinned[static_cast<std::size_t>(Register::DA)], reg(RAX));
+            break;
+        }
+        case Opcode::CAS:
+        case Opcode::XADD: {
+            // lock cmpxchg / lock xadd, the same host atomics the interpreters use.
+            // cmpxchg compares with EAX, so an indexed cell address moves to RCX first.
+            int ayb = pinned[static_cast<std::size_t>(Register::AYB)];
+            Location cell = dst;
+            if (dst.index >= 0) {
+                a.op({ 0x8d }, RCX, dst, true); // lea rcx, [rcx + rax*4]
+                cell = mem(RCX, 0);
+            }
+            load(RDX, src);
+            if (inst.opcode == Opcode::CAS) {
+                a.op({ 0x8b }, RAX, reg(ayb));
+                a.byte(0xf0);
+                a.op({ 0x0f, 0xb1 }, RDX, cell);
+                a.op({ 0x8b }, ayb, reg(RAX));
+            }
+            else {
+                a.byte(0xf0);
+                a.op({ 0x0f, 0xc1 }, RDX, cell);
+                a.op({ 0x8b }, ayb, reg(RDX));
+            }
+            break;
+        }
+        case Opcode::FENCE:
+            a.byte(0x0f); // mfence
+            a.byte(0xae);
+            a.byte(0xf0);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void stubs()
+    {
+        for (const auto& exit : exits) {
+            a.bind(exit.second);
+            a.op({ 0xc7 }, 0, mem(RSI, registerOffset(static_cast<std::size_t>(Register::GH))));
+            a.dword(static_cast<std::uint32_t>(exit.first.first));
+            a.movImm(RAX, static_cast<std::int32_t>(exit.first.second));
+            a.jump(epilogue);
+        }
+
+        a.bind(epilogue);
+        for (std::size_t r = 0; r < registerCount; ++r) {
+            if (pinned[r] >= 0) {
+                a.op({ 0x89 }, pinned[r], mem(RSI, registerOffset(r)));
+            }
+        }
+        a.op({ 0x89 }, R12, mem(RSI, offsetof(JitCode::Context, retired)), true);
+        a.pop(R13);
+        a.pop(R12);
+        a.pop(RBP);
+        a.pop(RBX);
+        a.byte(0xc3); // ret
+
+        a.bind(table);
+        for (std::size_t i = 0; i < instSize; ++i) {
+            a.offset(entries[i], table);
+        }
+    }
+
+private:
+    const Program& program;
+    std::size_t instSize;
+    std::size_t memorySize;
+    int pageShift;
+    Assembler a;
+    int epilogue;
+    int table;
+    std::vector<int> entries; // dispatch with the budget check, what jumps land on
+    std::vector<int> bodies;
+    std::map<std::pair<std::size_t, JitCode::Exit>, int> exits;
+};
+
+}
+
+std::unique_ptr<JitCode> JitCode::compile(const Program& program, std::size_t memorySize, std::size_t pageCells)
+{
+    int pageShift = 0;
+    while ((std::size_t(1) << pageShift) < pageCells) {
+        ++pageShift;
+    }
+    if ((std::size_t(1) << pageShift) != pageCells || program.code.size() != program.instructions.size()) {
+        return nullptr;
+    }
+    for (const Instruction& inst : program.instructions) {
+        if (!supported(inst)) {
+            return nullptr;
+        }
+    }
+
+    std::vector<std::uint8_t> bytes = Translator(program, memorySize, pageShift).translate();
+    void* code = ::mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(code, bytes.data(), bytes.size());
+    if (::mprotect(code, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+        ::munmap(code, bytes.size());
+        return nullptr;
+    }
+    return std::unique_ptr<JitCode>(new JitCode(code, bytes.size()));
+}
+
+JitCode::~JitCode()
+{
+    ::munmap(code, size);
+}
+
+JitCode::Exit JitCode::run(Context& context) const
+{
+    using Entry = int (*)(Context*);
+    return static_cast<Exit>(reinterpret_cast<Entry>(code)(&context));
+}
+
+#else
+
+std::unique_ptr<JitCode> JitCode::compile(const Program&, std::size_t, std::size_t)
+{
+    return nullptr;
+}
+
+JitCode::~JitCode()
+{
+}
+
+JitCode::Exit JitCode::run(Context&) const
+{
+    return Exit::Done;
+}
+
+#endif
+
+JitCode::JitCode(void* code, std::size_t size)
+    : code(code)
+    , size(size)
+{
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Instruction.h"
+#include "Program.h"
+
+// Native x86-64 translation of a loaded program, what Cpu::Engine::Jit runs.
+// Simulated registers live in host registers for the whole run and every jump is a
+// native jump; GH is only written back on exit. The code keeps the interpreter's
+// retired count and step budget, superinstruction boundaries included, so results
+// are identical to the interpreters'.
+class JitCode
+{
+public:
+	// what the generated code reads on entry and writes back on exit
+	struct Context
+	{
+		std::array<int, registerCount> registers;
+		std::uint64_t retired;
+		std::uint64_t stepLimit;
+		int* const* pages; // cells of every memory page, all writable
+	};
+
+	enum class Exit : int
+	{
+		Done,           // GH left the program or the budget ran out
+		DivideByZero,
+		BelowData,      // an indirect address fell into the instructions
+		AboveMemory     // an indirect address fell past the end of memory
+	};
+
+	// nullptr when the host isn't x86-64 System V or the program writes GH
+	// or addresses memory through it, the caller interprets those instead
+	static std::unique_ptr<JitCode> compile(const Program& program, std::size_t memorySize, std::size_t pageCells);
+	~JitCode();
+	JitCode(const JitCode&) = delete;
+	JitCode& operator=(const JitCode&) = delete;
+
+public:
+	Exit run(Context& context) const;
+
+private:
+	JitCode(void* code, std::size_t size);
+
+private:
+	void* code;
+	std::size_t size;
+};
@@ -0,0 +1,526 @@
+#include "Lockstep.h"
+#include "Cpu.h"
+#include <limits>
+
+#if defined(__GNUC__)
+#define LOCKSTEP_INLINE inline __attribute__((always_inline))
+#else
+#define LOCKSTEP_INLINE inline
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOCKSTEP_X86 1
+#endif
+
+// lanes are independent, a row may be read and written in the same loop (ADD BEN , BEN)
+#if defined(__clang__)
+#define LOCKSTEP_LANES _Pragma("clang loop vectorize(enable)")
+#elif defined(__GNUC__)
+#define LOCKSTEP_LANES _Pragma("GCC ivdep")
+#else
+#define LOCKSTEP_LANES
+#endif
+
+namespace {
+
+using Lane = std::int32_t;
+constexpr std::size_t chunk = LockstepCpu::chunk;
+
+// Every lane loop below runs in fixed chunks of 8, so the compiler turns the inner loop
+// into whole vector operations for whichever instruction set the caller was built for
+// (one AVX2 register, two SSE registers or plain scalar code).
+struct Lanes
+{
+    Lane* registers;
+    Lane* memory;
+    Lane* alive;
+    Lane* mask;    // -1 for lanes executing the current instruction
+    Lane* scratch; // broadcast immediates
+    std::size_t count;
+    std::size_t instSize;   // constant memory addresses were checked by Cpu::load
+    std::size_t memorySize; // for Indirect operands
+};
+
+LOCKSTEP_INLINE Lane* row(Lanes& s, Register r)
+{
+    return s.registers + static_cast<std::size_t>(r) * s.count;
+}
+
+LOCKSTEP_INLINE Lane* row(Lanes& s, const Operand& operand)
+{
+    switch (operand.kind) {
+    case OperandKind::Register:
+        return s.registers + static_cast<std::size_t>(operand.value) * s.count;
+    case OperandKind::Memory:
+        return s.memory + static_cast<std::size_t>(operand.value) * s.count;
+    default:
+        for (std::size_t c = 0; c < s.count; c += chunk) {
+            LOCKSTEP_LANES
+            for (std::size_t k = 0; k < chunk; ++k) {
+                s.scratch[c + k] = operand.value;
+            }
+        }
+        return s.scratch;
+    }
+}
+
+// wraps on overflow like the two's complement host does for Cpu
+template <Opcode op>
+LOCKSTEP_INLINE Lane compute(Lane a, Lane b)
+{
+    std::uint32_t ua = static_cast<std::uint32_t>(a);
+    std::uint32_t ub = static_cast<std::uint32_t>(b);
+    if constexpr (op == Opcode::MOV) {
+        return b;
+    }
+    else if constexpr (op == Opcode::ADD) {
+        return static_cast<Lane>(ua + ub);
+    }
+    else if constexpr (op == Opcode::SUB) {
+        return static_cast<Lane>(ua - ub);
+    }
+    else if constexpr (op == Opcode::MUL) {
+        return static_cast<Lane>(ua * ub);
+    }
+    else if constexpr (op == Opcode::AND) {
+        return a & b;
+    }
+    else if constexpr (op == Opcode::OR) {
+        return a | b;
+    }
+    else if constexpr (op == Opcode::NOT) {
+        return ~a;
+    }
+    else {
+        // CMP, same sign-of-difference rule as Cpu
+        Lane result = static_cast<Lane>(ua - ub);
+        return (result > 0) - (result < 0);
+    }
+}
+
+// -1 when the ADD, SUB or MUL that gave result overflowed, what Cpu evaluates ZA to
+template <Opcode op>
+LOCKSTEP_INLINE Lane overflowed(Lane a, Lane b, Lane result)
+{
+    if constexpr (op == Opcode::ADD) {
+        return ((a ^ result) & (b ^ result)) >> 31;
+    }
+    else if constexpr (op == Opcode::SUB) {
+        return ((a ^ b) & (a ^ result)) >> 31;
+    }
+    else {
+        return -static_cast<Lane>(static_cast<long long>(a) * b != result);
+    }
+}
+
+template <Opcode op>
+LOCKSTEP_INLINE void binary(Lane* dst, const Lane* a, const Lane* b, const Lane* mask, std::size_t count)
+{
+    for (std::size_t c = 0; c < count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            Lane result = compute<op>(a[l], b[l]);
+            dst[l] = (result & mask[l]) | (dst[l] & ~mask[l]);
+        }
+    }
+}
+
+// binary plus ZA, for ADD/SUB/MUL whose destination isn't ZA itself
+template <Opcode op>
+LOCKSTEP_INLINE void flagged(Lane* dst, const Lane* a, const Lane* b, Lane* za, const Lane* mask, std::size_t count)
+{
+    for (std::size_t c = 0; c < count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            Lane result = compute<op>(a[l], b[l]);
+            Lane overflow = overflowed<op>(a[l], b[l], result) & 1;
+            dst[l] = (result & mask[l]) | (dst[l] & ~mask[l]);
+            za[l] = (overflow & mask[l]) | (za[l] & ~mask[l]);
+        }
+    }
+}
+
+LOCKSTEP_INLINE bool writesZa(const Instruction& inst)
+{
+    return inst.dst.kind == OperandKind::Register && inst.dst.value == static_cast<int>(Register::ZA);
+}
+
+// GH of every masked lane that has not failed moves to the next instruction
+LOCKSTEP_INLINE void advance(Lanes& s)
+{
+    Lane* gh = row(s, Register::GH);
+    for (std::size_t c = 0; c < s.count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            gh[l] = compute<Opcode::ADD>(gh[l], s.mask[l] & s.alive[l] & 1); // wraps, GH may be INT_MAX
+        }
+    }
+}
+
+LOCKSTEP_INLINE void fail(Lanes& s)
+{
+    for (std::size_t c = 0; c < s.count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            s.alive[c + k] &= ~s.mask[c + k];
+        }
+    }
+}
+
+// Lane l's cell for operand, nullptr when an Indirect address is outside data memory
+LOCKSTEP_INLINE Lane* laneCell(Lanes& s, const Operand& operand, std::size_t l)
+{
+    switch (operand.kind) {
+    case OperandKind::Register:
+        return s.registers + static_cast<std::size_t>(operand.value) * s.count + l;
+    case OperandKind::Memory:
+        return s.memory + static_cast<std::size_t>(operand.value) * s.count + l;
+    case OperandKind::Indirect: {
+        long long address = static_cast<long long>(row(s, operand.base)[l]) + operand.value;
+        if (address < static_cast<long long>(s.instSize) || address >= static_cast<long long>(s.memorySize)) {
+            return nullptr;
+        }
+        return s.memory + static_cast<std::size_t>(address) * s.count + l;
+    }
+    default:
+        s.scratch[l] = operand.value;
+        return s.scratch + l;
+    }
+}
+
+// INT_MIN / -1 wraps to INT_MIN (dst as it is) and sets ZA, like Cpu
+LOCKSTEP_INLINE void divideLane(Lanes& s, const Instruction& inst, Lane* dst, Lane divisor, std::size_t l)
+{
+    bool overflow = *dst == std::numeric_limits<Lane>::min() && divisor == -1;
+    if (!overflow) {
+        *dst /= divisor;
+    }
+    if (!writesZa(inst)) {
+        row(s, Register::ZA)[l] = overflow;
+    }
+}
+
+// Indirect operands point every lane at a different cell, so like DIV these go lane by lane
+template <Opcode op>
+LOCKSTEP_INLINE void indirect(Lanes& s, const Instruction& inst)
+{
+    for (std::size_t l = 0; l < s.count; ++l) {
+        if (!s.mask[l]) {
+            continue;
+        }
+        Lane* dst = laneCell(s, inst.dst, l);
+        const Lane* src = op == Opcode::NOT ? dst : laneCell(s, inst.src, l);
+        if (dst == nullptr || src == nullptr) {
+            s.alive[l] = 0;
+            continue;
+        }
+        if constexpr (op == Opcode::DIV) {
+            if (*src == 0) {
+                s.alive[l] = 0; // Can't divide by zero
+            }
+            else {
+                divideLane(s, inst, dst, *src, l);
+            }
+        }
+        else if constexpr (op == Opcode::CMP) {
+            row(s, Register::DA)[l] = compute<op>(*dst, *src);
+        }
+        else if constexpr (op == Opcode::ADD || op == Opcode::SUB || op == Opcode::MUL) {
+            Lane result = compute<op>(*dst, *src);
+            Lane overflow = overflowed<op>(*dst, *src, result) & 1;
+            *dst = result;
+            if (!writesZa(inst)) {
+                row(s, Register::ZA)[l] = overflow;
+            }
+        }
+        else {
+            *dst = compute<op>(*dst, *src);
+        }
+    }
+    advance(s);
+}
+
+LOCKSTEP_INLINE bool hasIndirect(const Instruction& inst)
+{
+    return inst.dst.kind == OperandKind::Indirect || inst.src.kind == OperandKind::Indirect;
+}
+
+template <Opcode op>
+LOCKSTEP_INLINE void alu(Lanes& s, const Instruction& inst)
+{
+    if (hasIndirect(inst)) {
+        indirect<op>(s, inst);
+        return;
+    }
+    Lane* dst = row(s, inst.dst);
+    if constexpr (op == Opcode::MOV) {
+        binary<op>(dst, dst, row(s, inst.src), s.mask, s.count);
+    }
+    else if constexpr (op == Opcode::NOT) {
+        binary<op>(dst, dst, dst, s.mask, s.count);
+    }
+    else if constexpr (op == Opcode::CMP) {
+        binary<op>(row(s, Register::DA), dst, row(s, inst.src), s.mask, s.count);
+    }
+    else if constexpr (op == Opcode::ADD || op == Opcode::SUB || op == Opcode::MUL) {
+        if (writesZa(inst)) {
+            binary<op>(dst, dst, row(s, inst.src), s.mask, s.count);
+        }
+        else {
+            flagged<op>(dst, dst, row(s, inst.src), row(s, Register::ZA), s.mask, s.count);
+        }
+    }
+    else {
+        binary<op>(dst, dst, row(s, inst.src), s.mask, s.count);
+    }
+    advance(s);
+}
+
+// there is no vector integer division, lanes are divided one by one
+LOCKSTEP_INLINE void divide(Lanes& s, const Instruction& inst)
+{
+    if (hasIndirect(inst)) {
+        indirect<Opcode::DIV>(s, inst);
+        return;
+    }
+    Lane* dst = row(s, inst.dst);
+    const Lane* src = row(s, inst.src);
+    for (std::size_t l = 0; l < s.count; ++l) {
+        if (!s.mask[l]) {
+            continue;
+        }
+        if (src[l] == 0) {
+            s.alive[l] = 0; // Can't divide by zero
+        }
+        else {
+            divideLane(s, inst, dst + l, src[l], l);
+        }
+    }
+    advance(s);
+}
+
+// every lane owns its memory, so CAS is a plain compare-and-store and XADD an
+// add-and-return-old; the old cell goes to AYB as in Cpu
+template <Opcode op>
+LOCKSTEP_INLINE void atomic(Lanes& s, const Instruction& inst)
+{
+    Lane* ayb = row(s, Register::AYB);
+    for (std::size_t l = 0; l < s.count; ++l) {
+        if (!s.mask[l]) {
+            continue;
+        }
+        const Lane* src = laneCell(s, inst.src, l);
+        Lane* dst = laneCell(s, inst.dst, l);
+        if (dst == nullptr || src == nullptr) {
+            s.alive[l] = 0;
+            continue;
+        }
+        Lane old = *dst;
+        if constexpr (op == Opcode::CAS) {
+            if (old == ayb[l]) {
+                *dst = *src;
+            }
+        }
+        else {
+            *dst = compute<Opcode::ADD>(old, *src);
+        }
+        ayb[l] = old;
+    }
+    advance(s);
+}
+
+template <Opcode op>
+LOCKSTEP_INLINE void branch(Lanes& s, const Instruction& inst)
+{
+    Lane* gh = row(s, Register::GH);
+    const Lane* da = row(s, Register::DA);
+    for (std::size_t c = 0; c < s.count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            Lane taken = -1;
+            if constexpr (op == Opcode::JG) {
+                taken = -static_cast<Lane>(da[l] == 1);
+            }
+            else if constexpr (op == Opcode::JL) {
+                taken = -static_cast<Lane>(da[l] == -1);
+            }
+            else if constexpr (op == Opcode::JE) {
+                taken = -static_cast<Lane>(da[l] == 0);
+            }
+            Lane next = (inst.dst.value & taken) | (compute<Opcode::ADD>(gh[l], 1) & ~taken);
+            gh[l] = (next & s.mask[l]) | (gh[l] & ~s.mask[l]);
+        }
+    }
+}
+
+// Picks the lowest GH among live lanes and runs that instruction on every lane sitting
+// there. Returns false once no lane is left inside the program.
+LOCKSTEP_INLINE bool tick(Lanes& s, const Instruction* program)
+{
+    const Lane* gh = row(s, Register::GH);
+    // failed lanes become 0xffffffff, negative or past-the-end GH is outside the program anyway
+    std::uint32_t pc = std::numeric_limits<std::uint32_t>::max();
+    for (std::size_t c = 0; c < s.count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            std::uint32_t g = static_cast<std::uint32_t>(gh[l]) | ~static_cast<std::uint32_t>(s.alive[l]);
+            pc = g < pc ? g : pc;
+        }
+    }
+    if (pc >= s.instSize) {
+        return false;
+    }
+    for (std::size_t c = 0; c < s.count; c += chunk) {
+        LOCKSTEP_LANES
+        for (std::size_t k = 0; k < chunk; ++k) {
+            std::size_t l = c + k;
+            s.mask[l] = -static_cast<Lane>(static_cast<std::uint32_t>(gh[l]) == pc) & s.alive[l];
+        }
+    }
+
+    const Instruction& inst = program[pc];
+    switch (inst.opcode) {
+    case Opcode::MOV: alu<Opcode::MOV>(s, inst); break;
+    case Opcode::ADD: alu<Opcode::ADD>(s, inst); break;
+    case Opcode::SUB: alu<Opcode::SUB>(s, inst); break;
+    case Opcode::MUL: alu<Opcode::MUL>(s, inst); break;
+    case Opcode::DIV: divide(s, inst); break;
+    case Opcode::AND: alu<Opcode::AND>(s, inst); break;
+    case Opcode::OR: alu<Opcode::OR>(s, inst); break;
+    case Opcode::NOT: alu<Opcode::NOT>(s, inst); break;
+    case Opcode::CMP: alu<Opcode::CMP>(s, inst); break;
+    case Opcode::JMP: branch<Opcode::JMP>(s, inst); break;
+    case Opcode::JG: branch<Opcode::JG>(s, inst); break;
+    case Opcode::JL: branch<Opcode::JL>(s, inst); break;
+    case Opcode::JE: branch<Opcode::JE>(s, inst); break;
+    case Opcode::CAS: atomic<Opcode::CAS>(s, inst); break;
+    case Opcode::XADD: atomic<Opcode::XADD>(s, inst); break;
+    case Opcode::FENCE: advance(s); break; // lanes share nothing to order
+    default: fail(s); break;
+    }
+    return true;
+}
+
+// the same kernel compiled once per instruction set, picked at runtime
+using TickFn = bool (*)(Lanes&, const Instruction*);
+
+bool tickGeneric(Lanes& s, const Instruction* program)
+{
+    return tick(s, program);
+}
+
+#if defined(LOCKSTEP_X86)
+__attribute__((target("avx2"))) bool tickAvx2(Lanes& s, const Instruction* program)
+{
+    return tick(s, program);
+}
+
+__attribute__((target("sse4.1"))) bool tickSse41(Lanes& s, const Instruction* program)
+{
+    return tick(s, program);
+}
+#endif
+
+TickFn selectTick(const char** name)
+{
+#if defined(LOCKSTEP_X86)
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return tickAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        *name = "sse4.1";
+        return tickSse41;
+    }
+#endif
+    *name = "scalar";
+    return tickGeneric;
+}
+
+}
+
+LockstepCpu::LockstepCpu(std::size_t lanes, std::size_t cells)
+    : laneCount(lanes)
+    , paddedLanes((lanes + chunk - 1) / chunk * chunk)
+    , memorySize(cells)
+{
+}
+
+bool LockstepCpu::load(const std::string& file)
+{
+    Cpu cpu(Cpu::Engine::Switch, memorySize);
+    cpu.load(file);
+    if (cpu.failed()) {
+        return false;
+    }
+    program = cpu.instructions();
+    memorySize = cpu.memory_size();
+    registers.assign(registerCount * paddedLanes, 0);
+    memory.assign(memorySize * paddedLanes, 0);
+    // an object's data cells start out the same in every lane
+    for (std::size_t address = program.size(); address < memorySize; ++address) {
+        int value = cpu.read_memory(address);
+        for (std::size_t l = 0; l < laneCount; ++l) {
+            memory[address * paddedLanes + l] = value;
+        }
+    }
+    alive.assign(paddedLanes, 0);
+    for (std::size_t l = 0; l < laneCount; ++l) {
+        alive[l] = -1;
+    }
+    return true;
+}
+
+void LockstepCpu::run()
+{
+    std::vector<Lane> mask(paddedLanes, 0);
+    std::vector<Lane> scratch(paddedLanes, 0);
+    Lanes s = { registers.data(), memory.data(), alive.data(), mask.data(), scratch.data(),
+        paddedLanes, program.size(), memorySize };
+    const char* name = nullptr;
+    TickFn tickFn = selectTick(&name);
+    while (tickFn(s, program.data())) {
+    }
+}
+
+std::size_t LockstepCpu::lanes() const
+{
+    return laneCount;
+}
+
+void LockstepCpu::set_register(std::size_t lane, Register r, int value)
+{
+    registers[static_cast<std::size_t>(r) * paddedLanes + lane] = value;
+}
+
+void LockstepCpu::set_memory(std::size_t lane, std::size_t address, int value)
+{
+    memory[address * paddedLanes + lane] = value;
+}
+
+int LockstepCpu::read_register(std::size_t lane, Register r) const
+{
+    return registers[static_cast<std::size_t>(r) * paddedLanes + lane];
+}
+
+int LockstepCpu::read_memory(std::size_t lane, std::size_t address) const
+{
+    return memory[address * paddedLanes + lane];
+}
+
+bool LockstepCpu::failed(std::size_t lane) const
+{
+    return alive[lane] == 0;
+}
+
+const char* LockstepCpu::isa() const
+{
+    const char* name = nullptr;
+    selectTick(&name);
+    return name;
+}
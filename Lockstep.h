@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Instruction.h"
+
+// Runs one program on many Cpu register files / memories at once (parameter sweeps).
+// State is kept in structure-of-arrays layout, lane-contiguous per register and per
+// memory cell, and every instruction is applied to all lanes sitting at the same GH.
+// Lanes that diverge on JG/JL/JE are masked; the lowest GH always runs next, so lanes
+// reconverge as soon as they reach the same instruction again.
+// Every lane has its own memory, so CAS and XADD act on that lane's cell alone and
+// FENCE only moves GH on.
+class LockstepCpu
+{
+public:
+	explicit LockstepCpu(std::size_t lanes, std::size_t memorySize = 32); // memory cells per lane, as for Cpu
+
+public:
+	bool load(const std::string& file); // source text or object, data cells copied into every lane
+	void run();
+
+	std::size_t lanes() const;
+	void set_register(std::size_t lane, Register r, int value);
+	void set_memory(std::size_t lane, std::size_t address, int value);
+	int read_register(std::size_t lane, Register r) const;
+	int read_memory(std::size_t lane, std::size_t address) const;
+	bool failed(std::size_t lane) const;
+	const char* isa() const; // vector instruction set run() uses on this host
+
+public:
+	static constexpr std::size_t chunk = 8; // lanes per vector step, padding unit
+
+private:
+	std::size_t laneCount;
+	std::size_t paddedLanes;
+	std::size_t memorySize;
+	std::vector<Instruction> program;
+	std::vector<std::int32_t> registers; // registerCount rows of paddedLanes
+	std::vector<std::int32_t> memory;    // memorySize rows of paddedLanes
+	std::vector<std::int32_t> alive;     // -1 while the lane has not failed
+};
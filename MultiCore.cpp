@@ -0,0 +1,84 @@
+#include "MultiCore.h"
+#include <algorithm>
+#include <thread>
+
+MultiCore::MultiCore(std::size_t cores, Cpu::Engine engine, std::size_t memorySize)
+    : coreCount(std::max<std::size_t>(cores, 1))
+    , engine(engine)
+    , memorySize(memorySize)
+{
+    coreCpus.reserve(coreCount);
+    coreCpus.emplace_back(engine, memorySize);
+    addCores();
+}
+
+void MultiCore::load(const std::string& file)
+{
+    coreCpus.clear();
+    coreCpus.emplace_back(engine, memorySize);
+    coreCpus[0].load(file);
+    addCores();
+}
+
+void MultiCore::load(std::istream& in)
+{
+    coreCpus.clear();
+    coreCpus.emplace_back(engine, memorySize);
+    coreCpus[0].load(in);
+    addCores();
+}
+
+// The program is decoded, and compiled for the JIT, once: the other cores share it
+// with the first along with its memory. A failed load fails every core.
+void MultiCore::addCores()
+{
+    for (std::size_t i = 1; i < coreCount; ++i) {
+        coreCpus.push_back(coreCpus[0].share_memory());
+    }
+    for (std::size_t i = 0; i < coreCount; ++i) {
+        coreCpus[i].write_register(Register::ECH, static_cast<int>(i));
+    }
+}
+
+Cpu::RunStatus MultiCore::run(std::uint64_t maxSteps)
+{
+    std::vector<Cpu::RunStatus> statuses(coreCpus.size(), Cpu::RunStatus::Error);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < coreCpus.size(); ++i) {
+        threads.emplace_back([this, &statuses, i, maxSteps] {
+            statuses[i] = coreCpus[i].run(maxSteps);
+        });
+    }
+    statuses[0] = coreCpus[0].run(maxSteps);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (std::find(statuses.begin(), statuses.end(), Cpu::RunStatus::Error) != statuses.end()) {
+        return Cpu::RunStatus::Error;
+    }
+    if (std::find(statuses.begin(), statuses.end(), Cpu::RunStatus::BudgetExhausted) != statuses.end()) {
+        return Cpu::RunStatus::BudgetExhausted;
+    }
+    return Cpu::RunStatus::Halted;
+}
+
+std::size_t MultiCore::cores() const
+{
+    return coreCpus.size();
+}
+
+const Cpu& MultiCore::core(std::size_t index) const
+{
+    return coreCpus[index];
+}
+
+int MultiCore::read_memory(std::size_t address) const
+{
+    return coreCpus[0].read_memory(address);
+}
+
+bool MultiCore::failed() const
+{
+    return std::any_of(coreCpus.begin(), coreCpus.end(), [](const Cpu& cpu) { return cpu.failed(); });
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <string>
+#include <vector>
+#include "Cpu.h"
+
+// One simulated machine with several cores. Every core has its own registers and runs
+// on its own host thread; all of them load and store the same data memory (see
+// Cpu::share_memory). They run the same program, core i starting with i in ECH, and
+// coordinate through CAS, XADD and FENCE. Ordinary MOVs between cores are as ordered
+// as the host makes them, a program that needs more has to fence or use the atomics.
+class MultiCore
+{
+public:
+	explicit MultiCore(std::size_t cores, Cpu::Engine engine = Cpu::Engine::Threaded,
+		std::size_t memorySize = Cpu::defaultMemorySize);
+
+public:
+	void load(const std::string& file); // source text or object, as Cpu::load
+	void load(std::istream& in);
+	// Runs every core until it halts or has retired maxSteps instructions of its own.
+	// Error when any core failed, BudgetExhausted when any is still running, otherwise Halted.
+	Cpu::RunStatus run(std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max());
+
+	std::size_t cores() const;
+	const Cpu& core(std::size_t index) const;
+	int read_memory(std::size_t address) const;
+	bool failed() const; // of load, or of any core during run
+
+private:
+	void addCores();
+
+private:
+	std::size_t coreCount;
+	Cpu::Engine engine;
+	std::size_t memorySize;
+	std::vector<Cpu> coreCpus; // coreCpus[0] is the one the program was loaded into
+};
@@ -0,0 +1,76 @@
+#include "Object.h"
+#include <fstream>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPU_HAVE_MMAP 1
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#if defined(CPU_HAVE_MMAP)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = static_cast<std::size_t>(info.st_size);
+    if (length != 0) {
+        void* address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        bytes = static_cast<const std::uint8_t*>(address);
+        mapped = true;
+    }
+    ::close(fd); // the mapping stays valid
+    return true;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    bytes = contents.data();
+    length = contents.size();
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#if defined(CPU_HAVE_MMAP)
+    if (mapped) {
+        ::munmap(const_cast<std::uint8_t*>(bytes), length);
+    }
+#endif
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    contents.clear();
+}
+
+const std::uint8_t* MappedFile::data() const
+{
+    return bytes;
+}
+
+std::size_t MappedFile::size() const
+{
+    return length;
+}
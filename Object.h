@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Precompiled program written by Cpu::save_object (cpu --assemble) and read back by
+// Cpu::load without parsing any text. Sections follow the header in this order:
+//   ObjectInstruction[instructionCount]  decoded, before fusion
+//   ObjectLabel[labelCount]              resolved label table
+//   ObjectData[dataCount]                initial value of data cells
+//   char[stringBytes]                    instruction source and label names
+// Everything is stored as is, so the layouts are fixed.
+inline constexpr char objectMagic[8] = { 'C', 'P', 'U', 'O', 'B', 'J', 0, 0 };
+inline constexpr std::uint32_t objectVersion = 1;
+
+struct ObjectHeader
+{
+	char magic[8];                 // objectMagic
+	std::uint32_t version;
+	std::uint32_t instructionCount;
+	std::uint32_t labelCount;
+	std::uint32_t dataCount;
+	std::uint32_t stringBytes;
+	std::uint32_t reserved;
+};
+
+struct ObjectInstruction
+{
+	std::uint8_t opcode;      // Opcode
+	std::uint8_t dstKind;     // packKind
+	std::uint8_t srcKind;     // packKind
+	std::uint8_t reserved;
+	std::int32_t dst;
+	std::int32_t src;
+	std::uint32_t textOffset; // into the string section
+	std::uint32_t textLength;
+};
+
+struct ObjectLabel
+{
+	std::uint32_t address;
+	std::uint32_t nameOffset;
+	std::uint32_t nameLength;
+};
+
+struct ObjectData
+{
+	std::uint32_t address;
+	std::int32_t value;
+};
+
+static_assert(sizeof(ObjectHeader) == 32, "ObjectHeader is part of the object file format");
+static_assert(sizeof(ObjectInstruction) == 20, "ObjectInstruction is part of the object file format");
+static_assert(sizeof(ObjectLabel) == 12, "ObjectLabel is part of the object file format");
+static_assert(sizeof(ObjectData) == 8, "ObjectData is part of the object file format");
+
+// Read-only view of a whole file, memory-mapped where the platform allows it
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+	bool open(const std::string& path);
+	const std::uint8_t* data() const;
+	std::size_t size() const;
+
+private:
+	void close();
+
+private:
+	const std::uint8_t* bytes = nullptr;
+	std::size_t length = 0;
+	bool mapped = false;
+	std::vector<std::uint8_t> contents; // when mmap is not available
+};
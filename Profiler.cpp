@@ -0,0 +1,167 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+Profiler::Profiler()
+    : lastOpcode(Opcode::MOV)
+    , running(false)
+{
+}
+
+void Profiler::begin(std::size_t address, Opcode op)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (running) {
+        opcodeStats[static_cast<std::size_t>(lastOpcode)].nanoseconds +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    }
+    if (address >= addressCounts.size()) {
+        addressCounts.resize(address + 1, 0);
+    }
+    ++addressCounts[address];
+    ++opcodeStats[static_cast<std::size_t>(op)].count;
+    last = now;
+    lastOpcode = op;
+    running = true;
+}
+
+void Profiler::branch(Opcode op, bool taken)
+{
+    BranchStats& stats = branchStats[static_cast<std::size_t>(op)];
+    if (taken) {
+        ++stats.taken;
+    }
+    else {
+        ++stats.notTaken;
+    }
+}
+
+void Profiler::finish()
+{
+    if (running) {
+        opcodeStats[static_cast<std::size_t>(lastOpcode)].nanoseconds +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - last).count();
+    }
+    running = false;
+}
+
+void Profiler::reset()
+{
+    addressCounts.clear();
+    opcodeStats.fill(OpcodeStats());
+    branchStats.fill(BranchStats());
+    running = false;
+}
+
+const std::vector<std::uint64_t>& Profiler::address_counts() const
+{
+    return addressCounts;
+}
+
+const Profiler::OpcodeStats& Profiler::opcode(Opcode op) const
+{
+    return opcodeStats[static_cast<std::size_t>(op)];
+}
+
+const Profiler::BranchStats& Profiler::branches(Opcode op) const
+{
+    return branchStats[static_cast<std::size_t>(op)];
+}
+
+namespace {
+
+const Opcode conditionalJumps[] = { Opcode::JG, Opcode::JL, Opcode::JE };
+
+std::vector<std::size_t> hottestOpcodes(const std::array<Profiler::OpcodeStats, opcodeCount>& stats)
+{
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < opcodeCount; ++i) {
+        if (stats[i].count != 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return stats[a].nanoseconds > stats[b].nanoseconds;
+    });
+    return order;
+}
+
+std::vector<std::size_t> hottestAddresses(const std::vector<std::uint64_t>& counts)
+{
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] != 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return counts[a] > counts[b];
+    });
+    return order;
+}
+
+}
+
+void Profiler::report(std::ostream& out) const
+{
+    std::uint64_t total = 0;
+    std::uint64_t totalNanoseconds = 0;
+    for (const OpcodeStats& stats : opcodeStats) {
+        total += stats.count;
+        totalNanoseconds += stats.nanoseconds;
+    }
+
+    out << "Opcodes by host time:\n";
+    for (std::size_t i : hottestOpcodes(opcodeStats)) {
+        const OpcodeStats& stats = opcodeStats[i];
+        out << "  " << std::left << std::setw(8) << opcodeNames[i] << std::right
+            << std::setw(12) << stats.count << " executed "
+            << std::setw(12) << stats.nanoseconds << " ns "
+            << std::fixed << std::setprecision(1) << std::setw(5)
+            << (totalNanoseconds ? 100.0 * stats.nanoseconds / totalNanoseconds : 0.0) << "%\n";
+    }
+
+    out << "Addresses by execution count:\n";
+    for (std::size_t address : hottestAddresses(addressCounts)) {
+        out << "  [" << address << "] " << std::setw(12) << addressCounts[address] << ' '
+            << std::fixed << std::setprecision(1) << std::setw(5)
+            << (total ? 100.0 * addressCounts[address] / total : 0.0) << "%\n";
+    }
+
+    out << "Conditional jumps:\n";
+    for (Opcode op : conditionalJumps) {
+        const BranchStats& stats = branches(op);
+        std::uint64_t count = stats.taken + stats.notTaken;
+        out << "  " << std::left << std::setw(3) << opcodeNames[static_cast<std::size_t>(op)] << std::right
+            << std::setw(12) << stats.taken << " taken " << std::setw(12) << stats.notTaken << " not taken "
+            << std::fixed << std::setprecision(1) << std::setw(5)
+            << (count ? 100.0 * stats.taken / count : 0.0) << "% taken\n";
+    }
+}
+
+void Profiler::json(std::ostream& out) const
+{
+    out << "{\"opcodes\":[";
+    bool first = true;
+    for (std::size_t i : hottestOpcodes(opcodeStats)) {
+        out << (first ? "" : ",") << "{\"opcode\":\"" << opcodeNames[i] << "\",\"count\":" << opcodeStats[i].count
+            << ",\"nanoseconds\":" << opcodeStats[i].nanoseconds << '}';
+        first = false;
+    }
+    out << "],\"addresses\":[";
+    first = true;
+    for (std::size_t address : hottestAddresses(addressCounts)) {
+        out << (first ? "" : ",") << "{\"address\":" << address << ",\"count\":" << addressCounts[address] << '}';
+        first = false;
+    }
+    out << "],\"branches\":[";
+    first = true;
+    for (Opcode op : conditionalJumps) {
+        const BranchStats& stats = branches(op);
+        out << (first ? "" : ",") << "{\"opcode\":\"" << opcodeNames[static_cast<std::size_t>(op)]
+            << "\",\"taken\":" << stats.taken << ",\"not_taken\":" << stats.notTaken << '}';
+        first = false;
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#include "Instruction.h"
+
+// Collects where a Cpu spends its time. Attach with Cpu::set_profiler; a Cpu without
+// a profiler runs a separate, uninstrumented copy of its execution loop.
+// Superinstructions are counted as the two instructions they replace, each at its own address.
+class Profiler
+{
+public:
+	Profiler();
+
+public:
+	void begin(std::size_t address, Opcode op);
+	void branch(Opcode op, bool taken);
+	void finish();
+	void reset();
+
+	void report(std::ostream& out) const; // human readable, hottest first
+	void json(std::ostream& out) const;
+
+public:
+	struct OpcodeStats
+	{
+		std::uint64_t count = 0;
+		std::uint64_t nanoseconds = 0; // host time from dispatch of this opcode to the next one
+	};
+
+	struct BranchStats
+	{
+		std::uint64_t taken = 0;
+		std::uint64_t notTaken = 0;
+	};
+
+	const std::vector<std::uint64_t>& address_counts() const;
+	const OpcodeStats& opcode(Opcode op) const;
+	const BranchStats& branches(Opcode op) const; // JG, JL or JE
+
+private:
+	std::vector<std::uint64_t> addressCounts;
+	std::array<OpcodeStats, opcodeCount> opcodeStats;
+	std::array<BranchStats, opcodeCount> branchStats;
+	std::chrono::steady_clock::time_point last;
+	Opcode lastOpcode;
+	bool running;
+};
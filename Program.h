@@ -0,0 +1,18 @@
+#pragma once
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Instruction.h"
+
+// A decoded program. Never modified once Cpu::load has built it, so forked
+// Cpus share a single copy.
+struct Program
+{
+	std::vector<Instruction> instructions; // decoded, before fusion
+	std::vector<Instruction> code;         // after superinstruction fusion, what the engines run
+	std::vector<std::string> text;         // source of each instruction, for dump_memory
+	std::map<int, std::string> labels;     // instruction address -> label
+	std::vector<std::pair<int, int>> data; // address and initial value of data cells, from object files
+	std::size_t memorySize = 0;            // memory addresses were checked against this many cells
+};
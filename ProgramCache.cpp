@@ -0,0 +1,95 @@
+#include "ProgramCache.h"
+#include "Cpu.h"
+#include "Object.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+std::uint64_t contentHash(const std::string& content)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : content) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+}
+
+ProgramCache& ProgramCache::instance()
+{
+    static ProgramCache cache;
+    return cache;
+}
+
+std::shared_ptr<const Program> ProgramCache::load(const std::string& path, std::size_t memorySize, std::string& error)
+{
+    auto key = std::make_pair(path, memorySize);
+    std::error_code ec;
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, ec);
+    std::uintmax_t bytes = ec ? 0 : std::filesystem::file_size(path, ec);
+    if (ec) {
+        error = "ERROR while opening file";
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.modified == modified && it->second.bytes == bytes) {
+            return it->second.program;
+        }
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        error = "ERROR while opening file";
+        return nullptr;
+    }
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::uint64_t hash = contentHash(content);
+    {
+        // touched but unchanged, keep the decoded program
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.hash == hash) {
+            it->second.modified = modified;
+            it->second.bytes = bytes;
+            return it->second.program;
+        }
+    }
+
+    // decode without holding the lock, two threads missing on one path both decode it
+    Cpu decoder(Cpu::Engine::Switch, memorySize);
+    decoder.set_error_stream(nullptr); // the caller gets error instead
+    if (content.size() >= sizeof(objectMagic) && std::memcmp(content.data(), objectMagic, sizeof(objectMagic)) == 0) {
+        decoder.load_object(reinterpret_cast<const std::uint8_t*>(content.data()), content.size());
+    }
+    else {
+        std::istringstream source(content);
+        decoder.load(source);
+    }
+    if (decoder.failed()) {
+        error = decoder.error_message();
+        return nullptr;
+    }
+
+    std::shared_ptr<const Program> program = decoder.loaded_program();
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[key] = Entry{ modified, bytes, hash, program };
+    return program;
+}
+
+void ProgramCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+std::size_t ProgramCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "Program.h"
+
+// Process-wide cache of decoded programs, shared read-only between Cpus (Cpu::load
+// takes the result). A cached file costs one stat per lookup: it is read again only
+// when its size or modification time changed, and decoded again only when its
+// content hash changed as well. Safe to use from any thread.
+class ProgramCache
+{
+public:
+	static ProgramCache& instance();
+
+public:
+	// Decoded for a Cpu of memorySize cells. nullptr when the file can't be read or
+	// doesn't decode, error says why.
+	std::shared_ptr<const Program> load(const std::string& path, std::size_t memorySize, std::string& error);
+	void clear();
+	std::size_t size() const;
+
+private:
+	struct Entry
+	{
+		std::filesystem::file_time_type modified;
+		std::uintmax_t bytes;
+		std::uint64_t hash; // FNV-1a of the file content
+		std::shared_ptr<const Program> program;
+	};
+
+	mutable std::mutex mutex;
+	std::map<std::pair<std::string, std::size_t>, Entry> entries; // by path and memory size
+};
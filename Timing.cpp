@@ -0,0 +1,186 @@
+#include "Timing.h"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+std::array<std::uint32_t, opcodeCount> TimingConfig::defaultLatencies()
+{
+    std::array<std::uint32_t, opcodeCount> latency;
+    latency.fill(1);
+    latency[static_cast<std::size_t>(Opcode::MUL)] = 3;
+    latency[static_cast<std::size_t>(Opcode::DIV)] = 20;
+    latency[static_cast<std::size_t>(Opcode::CAS)] = 5;
+    latency[static_cast<std::size_t>(Opcode::XADD)] = 5;
+    latency[static_cast<std::size_t>(Opcode::FENCE)] = 8;
+    return latency;
+}
+
+namespace {
+
+bool isMemory(const Operand& operand)
+{
+    return operand.kind == OperandKind::Memory || operand.kind == OperandKind::Indirect;
+}
+
+bool usesRegister(const Operand& operand, int r)
+{
+    return (operand.kind == OperandKind::Register && operand.value == r)
+        || (operand.kind == OperandKind::Indirect && static_cast<int>(operand.base) == r);
+}
+
+// whether inst needs the value of register r before it can execute
+bool reads(const Instruction& inst, int r)
+{
+    switch (inst.opcode) {
+    case Opcode::JMP:
+    case Opcode::FENCE:
+        return false;
+    case Opcode::JG:
+    case Opcode::JL:
+    case Opcode::JE:
+        return r == static_cast<int>(Register::DA);
+    case Opcode::CAS:
+        return r == static_cast<int>(Register::AYB) || usesRegister(inst.dst, r) || usesRegister(inst.src, r);
+    case Opcode::MOV:
+        // the destination is only written, unless it is an address
+        return (inst.dst.kind == OperandKind::Indirect && static_cast<int>(inst.dst.base) == r)
+            || usesRegister(inst.src, r);
+    case Opcode::NOT:
+        return usesRegister(inst.dst, r);
+    default:
+        return usesRegister(inst.dst, r) || usesRegister(inst.src, r);
+    }
+}
+
+// the register inst fills with a value read from memory, -1 for none
+int loads(const Instruction& inst)
+{
+    if (inst.opcode == Opcode::CAS || inst.opcode == Opcode::XADD) {
+        return static_cast<int>(Register::AYB);
+    }
+    if (inst.dst.kind == OperandKind::Register && isMemory(inst.src) && inst.opcode != Opcode::CMP) {
+        return inst.dst.value;
+    }
+    return -1;
+}
+
+}
+
+TimingModel::TimingModel(const TimingConfig& timingConfig)
+    : config(timingConfig)
+{
+    config.cacheSets = std::max<std::uint32_t>(config.cacheSets, 1);
+    config.cacheWays = std::max<std::uint32_t>(config.cacheWays, 1);
+    config.cacheLineCells = std::max<std::uint32_t>(config.cacheLineCells, 1);
+    config.pipelineDepth = std::max<std::uint32_t>(config.pipelineDepth, 1);
+    reset();
+}
+
+void TimingModel::retire(std::size_t address, const Instruction& inst, int memoryAddress, bool taken)
+{
+    ++retired;
+    executeStalls += std::max<std::uint32_t>(config.latency[static_cast<std::size_t>(inst.opcode)], 1) - 1;
+    if (loadedRegister >= 0 && reads(inst, loadedRegister)) {
+        loadUseStalls += config.loadUsePenalty;
+    }
+    loadedRegister = memoryAddress >= 0 ? loads(inst) : -1;
+    if (memoryAddress >= 0 && !access(memoryAddress)) {
+        memoryStalls += config.missPenalty;
+    }
+    if (inst.opcode == Opcode::JG || inst.opcode == Opcode::JL || inst.opcode == Opcode::JE) {
+        ++branches;
+        bool predicted = inst.dst.value <= static_cast<int>(address); // loops jump backwards
+        if (predicted != taken) {
+            ++mispredicted;
+            branchStalls += config.branchPenalty;
+        }
+    }
+}
+
+bool TimingModel::access(int memoryAddress)
+{
+    std::int64_t line = memoryAddress / static_cast<std::int64_t>(config.cacheLineCells);
+    auto set = cacheTags.begin() + static_cast<std::ptrdiff_t>(line % config.cacheSets * config.cacheWays);
+    auto end = set + config.cacheWays;
+    auto way = std::find(set, end, line);
+    bool hit = way != end;
+    if (hit) {
+        ++hits;
+    }
+    else {
+        ++misses;
+        way = end - 1; // least recently used, or an empty way
+    }
+    std::rotate(set, way, way + 1);
+    *set = line;
+    return hit;
+}
+
+void TimingModel::reset()
+{
+    cacheTags.assign(static_cast<std::size_t>(config.cacheSets) * config.cacheWays, -1);
+    retired = 0;
+    executeStalls = 0;
+    memoryStalls = 0;
+    loadUseStalls = 0;
+    branchStalls = 0;
+    hits = 0;
+    misses = 0;
+    branches = 0;
+    mispredicted = 0;
+    loadedRegister = -1;
+}
+
+std::uint64_t TimingModel::instructions() const
+{
+    return retired;
+}
+
+std::uint64_t TimingModel::cycles() const
+{
+    if (retired == 0) {
+        return 0;
+    }
+    return config.pipelineDepth - 1 + retired + executeStalls + memoryStalls + loadUseStalls + branchStalls;
+}
+
+double TimingModel::cpi() const
+{
+    return retired ? static_cast<double>(cycles()) / retired : 0.0;
+}
+
+std::uint64_t TimingModel::cache_hits() const
+{
+    return hits;
+}
+
+std::uint64_t TimingModel::cache_misses() const
+{
+    return misses;
+}
+
+std::uint64_t TimingModel::mispredictions() const
+{
+    return mispredicted;
+}
+
+void TimingModel::report(std::ostream& out) const
+{
+    std::uint64_t accesses = hits + misses;
+    out << "Timing estimate:\n"
+        << "  instructions " << std::setw(14) << retired << '\n'
+        << "  cycles       " << std::setw(14) << cycles() << '\n'
+        << "  CPI          " << std::setw(14) << std::fixed << std::setprecision(2) << cpi() << '\n'
+        << "Stall cycles:\n"
+        << "  execute      " << std::setw(14) << executeStalls << '\n'
+        << "  cache miss   " << std::setw(14) << memoryStalls << '\n'
+        << "  load-use     " << std::setw(14) << loadUseStalls << '\n'
+        << "  branch       " << std::setw(14) << branchStalls << '\n'
+        << "Data cache (" << config.cacheSets << " sets x " << config.cacheWays << " ways x "
+        << config.cacheLineCells << " cells):\n"
+        << "  hits         " << std::setw(14) << hits << '\n'
+        << "  misses       " << std::setw(14) << misses << ' '
+        << std::setprecision(1) << std::setw(5) << (accesses ? 100.0 * misses / accesses : 0.0) << "%\n"
+        << "Conditional jumps:\n"
+        << "  mispredicted " << std::setw(14) << mispredicted << " of " << branches << '\n';
+}
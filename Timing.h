@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#include "Instruction.h"
+
+// What TimingModel charges. Latencies are in cycles and indexed by Opcode, superinstructions
+// are charged as their two halves so their entries are unused.
+struct TimingConfig
+{
+	std::array<std::uint32_t, opcodeCount> latency = defaultLatencies(); // execute stage, 1 = fully pipelined
+	std::uint32_t pipelineDepth = 5;   // stages, the first instruction pays depth - 1 cycles to fill them
+	std::uint32_t branchPenalty = 3;   // cycles flushed by a mispredicted JG/JL/JE
+	std::uint32_t loadUsePenalty = 1;  // bubble when an instruction needs a register the previous one loaded
+	std::uint32_t cacheSets = 16;      // data cache geometry, in memory cells
+	std::uint32_t cacheWays = 2;
+	std::uint32_t cacheLineCells = 8;
+	std::uint32_t missPenalty = 20;    // cycles a data cache miss stalls the pipeline
+
+	static std::array<std::uint32_t, opcodeCount> defaultLatencies(); // MUL 3, DIV 20, CAS/XADD 5, FENCE 8, others 1
+};
+
+// Estimates the cycles a run would take on a single-issue in-order pipeline with
+// forwarding, a static backward-taken / forward-not-taken predictor for the conditional
+// jumps and an LRU set-associative data cache over the memory cells. Attach with
+// Cpu::set_timing_model; it only observes, results are the same as without it.
+class TimingModel
+{
+public:
+	explicit TimingModel(const TimingConfig& config = TimingConfig());
+
+public:
+	// one original instruction at address, after it ran; memoryAddress is the cell it
+	// loaded or stored, -1 for none, taken only matters for jumps
+	void retire(std::size_t address, const Instruction& inst, int memoryAddress, bool taken);
+	void reset();
+
+	std::uint64_t instructions() const;
+	std::uint64_t cycles() const;
+	double cpi() const;
+	std::uint64_t cache_hits() const;
+	std::uint64_t cache_misses() const;
+	std::uint64_t mispredictions() const;
+
+	void report(std::ostream& out) const;
+
+private:
+	bool access(int memoryAddress); // true on a hit
+
+private:
+	TimingConfig config;
+	std::vector<std::int64_t> cacheTags; // cacheSets rows of cacheWays tags, most recently used first, -1 empty
+	std::uint64_t retired;
+	std::uint64_t executeStalls; // cycles beyond the first of multi-cycle opcodes
+	std::uint64_t memoryStalls;
+	std::uint64_t loadUseStalls;
+	std::uint64_t branchStalls;
+	std::uint64_t hits;
+	std::uint64_t misses;
+	std::uint64_t branches;
+	std::uint64_t mispredicted;
+	int loadedRegister; // register the previous instruction loaded from memory, -1 for none
+};
@@ -0,0 +1,129 @@
+#include "Trace.h"
+#include <cstring>
+
+namespace {
+
+const char traceMagic[8] = { 'C', 'P', 'U', 'T', 'R', 'A', 'C', 'E' };
+const std::uint32_t traceVersion = 1;
+
+TraceHeader makeHeader(std::uint64_t firstSequence)
+{
+    TraceHeader header;
+    std::memcpy(header.magic, traceMagic, sizeof(traceMagic));
+    header.version = traceVersion;
+    header.recordSize = sizeof(TraceRecord);
+    header.firstSequence = firstSequence;
+    return header;
+}
+
+}
+
+Tracer::Tracer(std::size_t capacity)
+    : mask(0)
+    , total(0)
+    , flushed(0)
+{
+    std::size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring.resize(size);
+    mask = size - 1;
+}
+
+bool Tracer::stream_to(const std::string& path)
+{
+    stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!stream.is_open()) {
+        return false;
+    }
+    flushed = total;
+    TraceHeader header = makeHeader(total);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(stream);
+}
+
+void Tracer::record(std::size_t address, const Instruction& inst, const Operand& changed, int value)
+{
+    TraceRecord& r = ring[total & mask];
+    r.address = static_cast<std::uint32_t>(address);
+    r.opcode = static_cast<std::uint8_t>(inst.opcode);
+    r.dstKind = packKind(inst.dst);
+    r.srcKind = packKind(inst.src);
+    r.changedKind = static_cast<std::uint8_t>(changed.kind);
+    r.dst = inst.dst.value;
+    r.src = inst.src.value;
+    r.changed = changed.value;
+    r.value = value;
+    ++total;
+    if (stream.is_open() && total - flushed == ring.size()) {
+        flush();
+    }
+}
+
+void Tracer::flush()
+{
+    if (!stream.is_open()) {
+        return;
+    }
+    write(stream, flushed);
+    stream.flush();
+    flushed = total;
+}
+
+// records [from, total) in order, at most one ring's worth
+void Tracer::write(std::ostream& out, std::uint64_t from) const
+{
+    std::size_t begin = static_cast<std::size_t>(from & mask);
+    std::size_t count = static_cast<std::size_t>(total - from);
+    std::size_t first = std::min(count, ring.size() - begin);
+    out.write(reinterpret_cast<const char*>(&ring[begin]), first * sizeof(TraceRecord));
+    out.write(reinterpret_cast<const char*>(&ring[0]), (count - first) * sizeof(TraceRecord));
+}
+
+bool Tracer::dump(const std::string& path) const
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    std::uint64_t from = total > ring.size() ? total - ring.size() : 0;
+    TraceHeader header = makeHeader(from);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write(out, from);
+    return static_cast<bool>(out);
+}
+
+std::uint64_t Tracer::recorded() const
+{
+    return total;
+}
+
+std::vector<TraceRecord> Tracer::records() const
+{
+    std::uint64_t from = total > ring.size() ? total - ring.size() : 0;
+    std::vector<TraceRecord> result;
+    result.reserve(static_cast<std::size_t>(total - from));
+    for (std::uint64_t i = from; i < total; ++i) {
+        result.push_back(ring[i & mask]);
+    }
+    return result;
+}
+
+bool Tracer::read(const std::string& path, TraceHeader& header, std::vector<TraceRecord>& records)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open() || !in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    if (std::memcmp(header.magic, traceMagic, sizeof(traceMagic)) != 0
+        || header.version != traceVersion || header.recordSize != sizeof(TraceRecord)) {
+        return false;
+    }
+    records.clear();
+    TraceRecord record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return true;
+}
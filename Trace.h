@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Instruction.h"
+
+// One retired instruction. Written to disk as is, so the layout is fixed.
+struct TraceRecord
+{
+	std::uint32_t address;    // GH of the instruction
+	std::uint8_t opcode;      // Opcode, superinstructions are recorded as their two halves
+	std::uint8_t dstKind;     // packKind
+	std::uint8_t srcKind;     // packKind
+	std::uint8_t changedKind; // OperandKind::None when nothing but GH changed
+	std::int32_t dst;
+	std::int32_t src;
+	std::int32_t changed;     // register index or memory address
+	std::int32_t value;       // value of changed after the instruction
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is part of the trace file format");
+
+struct TraceHeader
+{
+	char magic[8];               // "CPUTRACE"
+	std::uint32_t version;
+	std::uint32_t recordSize;
+	std::uint64_t firstSequence; // sequence number of the first record in the file
+};
+
+// Fixed-size ring of TraceRecords filled by Cpu::set_tracer. Recording is a plain
+// store into the ring; without a stream the oldest records are overwritten, with one
+// every full ring is appended to the file in a single write.
+class Tracer
+{
+public:
+	explicit Tracer(std::size_t capacity = 1 << 16); // rounded up to a power of two
+
+public:
+	bool stream_to(const std::string& path);
+	void record(std::size_t address, const Instruction& inst, const Operand& changed, int value);
+	void flush();
+	bool dump(const std::string& path) const; // the records still held in the ring
+	std::uint64_t recorded() const;
+	std::vector<TraceRecord> records() const; // oldest first
+
+	static bool read(const std::string& path, TraceHeader& header, std::vector<TraceRecord>& records);
+
+private:
+	void write(std::ostream& out, std::uint64_t from) const;
+
+private:
+	std::vector<TraceRecord> ring;
+	std::size_t mask;
+	std::uint64_t total;
+	std::uint64_t flushed; // records already written to the stream
+	std::ofstream stream;
+};
@@ -0,0 +1,262 @@
+// Benchmarks for Cpu::execute: throughput per engine and heap allocations per run.
+// Exits with 1 if a program gives the wrong result or run touches the heap after load.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "Cpu.h"
+#include "Lockstep.h"
+#include "MultiCore.h"
+
+namespace {
+
+std::uint64_t allocations = 0;
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+struct Benchmark
+{
+    const char* name;
+    std::string source;
+    bool (*check)(const Cpu& cpu);
+};
+
+const int iterations = 10000000;
+
+// Stores to the same two cells 10^7 times. Stores must overwrite in place,
+// so afterwards only [10] and [11] hold values and every other cell is untouched.
+Benchmark storeLoop()
+{
+    return { "store_loop",
+        "MOV BEN , 0\n"
+        "loop: ADD BEN , 1\n"
+        "MOV [10] , BEN\n"
+        "ADD [11] , 1\n"
+        "CMP BEN , " + std::to_string(iterations) + "\n"
+        "JL loop\n",
+        [](const Cpu& cpu) {
+            bool ok = cpu.read_memory(10) == iterations && cpu.read_memory(11) == iterations;
+            for (std::size_t i = 12; i < cpu.memory_size(); ++i) {
+                ok = ok && cpu.read_memory(i) == 0;
+            }
+            return ok;
+        } };
+}
+
+Benchmark countingLoop()
+{
+    return { "counting_loop",
+        "MOV BEN , 0\n"
+        "loop: ADD BEN , 1\n"
+        "CMP BEN , " + std::to_string(iterations) + "\n"
+        "JL loop\n",
+        [](const Cpu& cpu) { return cpu.read_register(Register::BEN) == iterations; } };
+}
+
+// sums three cells into a fourth on every iteration
+Benchmark memoryAccumulate()
+{
+    return { "memory_accumulate",
+        "MOV [20] , 1\n"
+        "MOV [21] , 2\n"
+        "MOV [22] , 3\n"
+        "MOV BEN , 0\n"
+        "loop: MOV AYB , [20]\n"
+        "ADD AYB , [21]\n"
+        "ADD AYB , [22]\n"
+        "ADD [23] , AYB\n"
+        "AND [23] , 65535\n"
+        "ADD BEN , 1\n"
+        "CMP BEN , " + std::to_string(iterations / 2) + "\n"
+        "JL loop\n",
+        [](const Cpu& cpu) {
+            return cpu.read_memory(23) == static_cast<int>((6LL * (iterations / 2)) & 65535);
+        } };
+}
+
+// three-way branch on BEN mod 4 every iteration
+Benchmark branchy()
+{
+    return { "branchy",
+        "MOV BEN , 0\n"
+        "loop: MOV GIM , BEN\n"
+        "AND GIM , 3\n"
+        "CMP GIM , 1\n"
+        "JE one\n"
+        "JG big\n"
+        "ADD [20] , 1\n"
+        "JMP next\n"
+        "one: ADD [21] , 1\n"
+        "JMP next\n"
+        "big: ADD [22] , 1\n"
+        "next: ADD BEN , 1\n"
+        "CMP BEN , " + std::to_string(iterations / 2) + "\n"
+        "JL loop\n",
+        [](const Cpu& cpu) {
+            return cpu.read_memory(20) == iterations / 8 && cpu.read_memory(21) == iterations / 8
+                && cpu.read_memory(22) == iterations / 4;
+        } };
+}
+
+Benchmark arithmeticMix()
+{
+    return { "arithmetic_mix",
+        "MOV BEN , 0\n"
+        "MOV AYB , 1\n"
+        "loop: MUL AYB , 3\n"
+        "ADD AYB , BEN\n"
+        "SUB AYB , 7\n"
+        "DIV AYB , 2\n"
+        "OR AYB , 1\n"
+        "AND AYB , 1048575\n"
+        "NOT GIM\n"
+        "ADD BEN , 1\n"
+        "CMP BEN , " + std::to_string(iterations / 2) + "\n"
+        "JL loop\n",
+        [](const Cpu& cpu) { return cpu.read_register(Register::BEN) == iterations / 2; } };
+}
+
+bool runBenchmark(const Benchmark& benchmark, Cpu::Engine engine, const char* engineName)
+{
+    Cpu cpu(engine);
+    cpu.clear();
+    std::istringstream in(benchmark.source);
+    std::uint64_t before = allocations;
+    cpu.load(in);
+    std::uint64_t loadAllocations = allocations - before;
+
+    before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    cpu.run();
+    auto end = std::chrono::steady_clock::now();
+    std::uint64_t runAllocations = allocations - before;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double retired = static_cast<double>(cpu.instructions_retired());
+    bool ok = !cpu.failed() && benchmark.check(cpu);
+
+    // the same Cpu reloaded and run in slices must not allocate either
+    cpu.clear();
+    std::istringstream again(benchmark.source);
+    cpu.load(again);
+    before = allocations;
+    while (cpu.run(1000) == Cpu::RunStatus::BudgetExhausted) {
+    }
+    runAllocations += allocations - before;
+    ok = ok && !cpu.failed() && benchmark.check(cpu);
+
+    std::cout << std::left << std::setw(18) << benchmark.name << std::setw(10) << engineName << std::right
+              << std::setw(12) << cpu.instructions_retired() << " instr "
+              << std::fixed << std::setprecision(1) << std::setw(8) << retired / seconds / 1e6 << " Minstr/s "
+              << std::setprecision(2) << std::setw(6) << seconds * 1e9 / retired << " ns/instr "
+              << std::setw(5) << loadAllocations << " load allocs "
+              << std::setw(5) << runAllocations << " run allocs"
+              << (ok ? "" : "  WRONG RESULT") << (runAllocations == 0 ? "" : "  ALLOCATED WHILE RUNNING") << '\n';
+    return ok && runAllocations == 0;
+}
+
+// Every core of a MultiCore, one per hardware thread, counts its share of the iterations
+// into one cell with XADD; the aggregate rate shows how an engine scales across cores.
+// Starting the threads allocates, so there is no allocation check here.
+bool runMultiCore(Cpu::Engine engine, const char* engineName)
+{
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    int perCore = iterations / static_cast<int>(cores);
+    MultiCore machine(cores, engine);
+    std::istringstream in(
+        "MOV BEN , 0\n"
+        "loop: XADD [20] , 1\n"
+        "ADD BEN , 1\n"
+        "CMP BEN , " + std::to_string(perCore) + "\n"
+        "JL loop\n");
+    machine.load(in);
+
+    auto start = std::chrono::steady_clock::now();
+    Cpu::RunStatus status = machine.run();
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::uint64_t retired = 0;
+    for (std::size_t i = 0; i < machine.cores(); ++i) {
+        retired += machine.core(i).instructions_retired();
+    }
+    bool ok = status == Cpu::RunStatus::Halted && machine.read_memory(20) == perCore * static_cast<int>(cores);
+
+    std::string name = "shared_counter x" + std::to_string(cores);
+    std::cout << std::left << std::setw(18) << name << std::setw(10) << engineName << std::right
+              << std::setw(12) << retired << " instr "
+              << std::fixed << std::setprecision(1) << std::setw(8) << retired / seconds / 1e6 << " Minstr/s "
+              << std::setprecision(2) << std::setw(6) << seconds * 1e9 / retired << " ns/instr"
+              << (ok ? "" : "  WRONG RESULT") << '\n';
+    return ok;
+}
+
+// Not timed: an object's data cells have to reach every LockstepCpu lane. The object
+// is saved after one run, so its data holds [20] = 7 and running it again adds 7 more.
+bool checkLockstepObject()
+{
+    const char* path = "cpu_bench_lockstep.obj";
+    Cpu cpu(Cpu::Engine::Switch);
+    std::istringstream in("ADD [20] , 7\n");
+    cpu.load(in);
+    cpu.run();
+    bool ok = cpu.save_object(path);
+
+    LockstepCpu lockstep(LockstepCpu::chunk + 1);
+    ok = ok && lockstep.load(path);
+    std::remove(path);
+    if (ok) {
+        lockstep.run();
+        for (std::size_t l = 0; l < lockstep.lanes(); ++l) {
+            ok = ok && !lockstep.failed(l) && lockstep.read_memory(l, 20) == 14;
+        }
+    }
+    std::cout << std::left << std::setw(18) << "lockstep_object" << std::setw(10) << lockstep.isa()
+              << (ok ? "" : "  WRONG RESULT") << '\n';
+    return ok;
+}
+
+}
+
+int main()
+{
+    const Benchmark benchmarks[] = { storeLoop(), countingLoop(), memoryAccumulate(), branchy(), arithmeticMix() };
+    bool ok = true;
+    for (const Benchmark& benchmark : benchmarks) {
+        ok = runBenchmark(benchmark, Cpu::Engine::Switch, "switch") && ok;
+        ok = runBenchmark(benchmark, Cpu::Engine::Threaded, "threaded") && ok;
+        ok = runBenchmark(benchmark, Cpu::Engine::Jit, "jit") && ok;
+    }
+    ok = runMultiCore(Cpu::Engine::Threaded, "threaded") && ok;
+    ok = runMultiCore(Cpu::Engine::Jit, "jit") && ok;
+    ok = checkLockstepObject() && ok;
+    return ok ? 0 : 1;
+}
@@ -1,14 +1,251 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
 #include "Cpu.h"
+#include "Batch.h"
+#include "MultiCore.h"
+#include "Profiler.h"
+#include "Timing.h"
+#include "Trace.h"
 
-int main()
+namespace {
+
+// a whole non-negative decimal number, as the numeric options take
+bool parseCount(const std::string& text, std::uint64_t& value)
+{
+	if (text.empty() || text[0] < '0' || text[0] > '9') {
+		return false;
+	}
+	try {
+		std::size_t end = 0;
+		value = std::stoull(text, &end);
+		return end == text.size();
+	}
+	catch (const std::logic_error&) { // invalid_argument or out_of_range
+		return false;
+	}
+}
+
+}
+
+// Usage: cpu [--profile | --profile-json] [--timing] [--trace file] [--max-steps n] [--memory cells] [--engine switch|threaded|jit] [--cores n] [--checkpoint file] [--assemble out] [program...]
+// One program (myCode.txt by default) is executed and its memory dumped,
+// followed by a profile report when asked for. --timing adds an estimate of
+// the cycles the run would take, see Timing.h. --trace streams a binary
+// execution trace to file, print it with cpu_trace_dump. --max-steps stops
+// programs that run longer than n instructions. --memory sets the memory size
+// (32 cells by default, at most 65536). --engine picks how programs are
+// executed, threaded by default. --cores runs a single program on n cores
+// sharing one memory (see MultiCore.h) and prints the registers of each core
+// after the memory. With --checkpoint a single
+// program resumes from file when it exists and saves its state there when
+// --max-steps stops it, so a long run can be continued across invocations.
+// --assemble writes the program as a precompiled object to out instead of
+// running it; objects are accepted anywhere a program path is.
+// Several programs run in parallel, one line of final registers each, in the given order;
+// of the options only --max-steps, --memory and --engine apply to them.
+int main(int argc, char* argv[])
 {
-	std::string path = "C:\\Users\\Monica\\OneDrive\\Documents\\Picsart\\Cpu\\Cpu\\myCode.txt";
-	Cpu myCpu;
-	myCpu.execute(path);
-	myCpu.dump_memory();
-	
-	return 0;
-}
\ No newline at end of file
+	int first = 1;
+	std::string profile;
+	std::string tracePath;
+	std::string checkpointPath;
+	std::string objectPath;
+	bool timing = false;
+	std::uint64_t maxSteps = std::numeric_limits<std::uint64_t>::max();
+	std::size_t memorySize = Cpu::defaultMemorySize;
+	Cpu::Engine engine = Cpu::Engine::Threaded;
+	std::size_t cores = 1;
+	while (first < argc && std::string(argv[first]).rfind("--", 0) == 0) {
+		std::string option = argv[first++];
+		if (option == "--profile" || option == "--profile-json") {
+			profile = option;
+		}
+		else if (option == "--timing") {
+			timing = true;
+		}
+		else if (option == "--trace" && first < argc) {
+			tracePath = argv[first++];
+		}
+		else if (option == "--max-steps" && first < argc) {
+			if (!parseCount(argv[first++], maxSteps)) {
+				std::cerr << "Invalid value for --max-steps\n";
+				return 1;
+			}
+		}
+		else if (option == "--memory" && first < argc) {
+			std::uint64_t cells = 0;
+			if (!parseCount(argv[first++], cells)) {
+				std::cerr << "Invalid value for --memory\n";
+				return 1;
+			}
+			memorySize = static_cast<std::size_t>(cells);
+		}
+		else if (option == "--engine" && first < argc) {
+			std::string name = argv[first++];
+			if (name == "switch") {
+				engine = Cpu::Engine::Switch;
+			}
+			else if (name == "threaded") {
+				engine = Cpu::Engine::Threaded;
+			}
+			else if (name == "jit") {
+				engine = Cpu::Engine::Jit;
+			}
+			else {
+				std::cerr << "Unknown engine " << name << '\n';
+				return 1;
+			}
+		}
+		else if (option == "--cores" && first < argc) {
+			std::uint64_t count = 0;
+			if (!parseCount(argv[first++], count)) {
+				std::cerr << "Invalid value for --cores\n";
+				return 1;
+			}
+			cores = static_cast<std::size_t>(count);
+		}
+		else if (option == "--checkpoint" && first < argc) {
+			checkpointPath = argv[first++];
+		}
+		else if (option == "--assemble" && first < argc) {
+			objectPath = argv[first++];
+		}
+		else {
+			std::cerr << "Unknown option " << option << '\n';
+			return 1;
+		}
+	}
+
+	if (argc - first <= 1 && cores > 1) {
+		std::string path = argc - first == 1 ? argv[first] : "myCode.txt";
+		if (!profile.empty() || timing || !tracePath.empty() || !checkpointPath.empty() || !objectPath.empty()) {
+			std::cerr << "--cores can't be combined with --profile, --timing, --trace, --checkpoint or --assemble\n";
+			return 1;
+		}
+		MultiCore machine(cores, engine, memorySize);
+		machine.load(path);
+		Cpu::RunStatus status = machine.run(maxSteps);
+		if (status == Cpu::RunStatus::BudgetExhausted) {
+			std::cerr << "Stopped after " << maxSteps << " instructions\n";
+			return 1;
+		}
+		if (status == Cpu::RunStatus::Error) {
+			return 1;
+		}
+		machine.core(0).dump_memory();
+		for (std::size_t c = 0; c < machine.cores(); ++c) {
+			std::cout << "core " << c << ":";
+			for (std::size_t i = 0; i < registerCount; ++i) {
+				std::cout << ' ' << registerNames[i] << '=' << machine.core(c).read_register(static_cast<Register>(i));
+			}
+			std::cout << '\n';
+		}
+		return 0;
+	}
+
+	if (argc - first <= 1) {
+		std::string path = argc - first == 1 ? argv[first] : "myCode.txt";
+		Cpu myCpu(engine, memorySize);
+		if (!objectPath.empty()) {
+			myCpu.load(path);
+			if (myCpu.failed()) {
+				return 1;
+			}
+			if (!myCpu.save_object(objectPath)) {
+				std::cerr << "ERROR while writing " << objectPath << '\n';
+				return 1;
+			}
+			return 0;
+		}
+		Profiler profiler;
+		if (!profile.empty()) {
+			myCpu.set_profiler(&profiler);
+		}
+		TimingModel timingModel;
+		if (timing) {
+			myCpu.set_timing_model(&timingModel);
+		}
+		Tracer tracer;
+		if (!tracePath.empty()) {
+			if (!tracer.stream_to(tracePath)) {
+				std::cerr << "ERROR while opening " << tracePath << '\n';
+				return 1;
+			}
+			myCpu.set_tracer(&tracer);
+		}
+		Cpu::RunStatus status;
+		if (checkpointPath.empty()) {
+			status = myCpu.execute(path, maxSteps);
+		}
+		else {
+			myCpu.load(path);
+			if (!myCpu.failed() && std::ifstream(checkpointPath).is_open() && !myCpu.load_snapshot(checkpointPath)) {
+				std::cerr << checkpointPath << " is not a snapshot of " << path << '\n';
+				return 1;
+			}
+			status = myCpu.run(maxSteps);
+		}
+		tracer.flush();
+		if (status == Cpu::RunStatus::Error) {
+			return 1;
+		}
+		if (status == Cpu::RunStatus::BudgetExhausted) {
+			std::cerr << "Stopped after " << maxSteps << " instructions\n";
+			if (!checkpointPath.empty()) {
+				if (!myCpu.save_snapshot(checkpointPath)) {
+					std::cerr << "ERROR while writing " << checkpointPath << '\n';
+				}
+				else {
+					std::cerr << "State saved to " << checkpointPath << '\n';
+				}
+			}
+			return 1;
+		}
+		myCpu.dump_memory();
+		if (profile == "--profile") {
+			profiler.report(std::cout);
+		}
+		else if (profile == "--profile-json") {
+			profiler.json(std::cout);
+		}
+		if (timing) {
+			timingModel.report(std::cout);
+		}
+		return 0;
+	}
+
+	if (cores > 1 || !profile.empty() || timing || !tracePath.empty() || !checkpointPath.empty() || !objectPath.empty()) {
+		std::cerr << "Several programs can't be combined with --cores, --profile, --timing, --trace, --checkpoint or --assemble\n";
+		return 1;
+	}
+	std::vector<BatchProgram> programs;
+	for (int i = first; i < argc; ++i) {
+		BatchProgram program;
+		program.name = argv[i];
+		programs.push_back(program);
+	}
+	int failures = 0;
+	for (const BatchResult& result : runBatch(programs, 0, maxSteps, memorySize, engine)) {
+		std::cout << result.name << ":";
+		if (result.status == Cpu::RunStatus::Error) {
+			std::cout << " error: " << result.error << '\n';
+			++failures;
+			continue;
+		}
+		if (result.status == Cpu::RunStatus::BudgetExhausted) {
+			std::cout << " stopped after " << maxSteps << " instructions\n";
+			++failures;
+			continue;
+		}
+		for (std::size_t i = 0; i < registerCount; ++i) {
+			std::cout << ' ' << registerNames[i] << '=' << result.registers[i];
+		}
+		std::cout << '\n';
+	}
+	return failures == 0 ? 0 : 1;
+}
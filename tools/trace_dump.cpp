@@ -0,0 +1,90 @@
+// Prints a trace written by Tracer::dump or Tracer::stream_to
+// Usage: cpu_trace_dump trace.bin
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Trace.h"
+
+namespace {
+
+void printOperand(std::ostream& out, std::uint8_t kind, std::int32_t value)
+{
+    Operand operand;
+    unpackKind(kind, operand);
+    switch (operand.kind) {
+    case OperandKind::Register:
+        out << registerNames[value];
+        break;
+    case OperandKind::Memory:
+        out << '[' << value << ']';
+        break;
+    case OperandKind::Indirect:
+        out << '[' << registerNames[static_cast<std::size_t>(operand.base)];
+        if (value != 0) {
+            out << (value > 0 ? "+" : "") << value;
+        }
+        out << ']';
+        break;
+    case OperandKind::Immediate:
+    case OperandKind::Label:
+        out << value;
+        break;
+    default:
+        break;
+    }
+}
+
+// Operand bytes come straight from the file, only names that exist may be looked up
+bool validOperand(std::uint8_t kind, std::int32_t value)
+{
+    Operand operand;
+    unpackKind(kind, operand);
+    if (operand.kind > OperandKind::Indirect || static_cast<std::size_t>(operand.base) >= registerCount) {
+        return false;
+    }
+    return operand.kind != OperandKind::Register || (value >= 0 && static_cast<std::size_t>(value) < registerCount);
+}
+
+bool validRecord(const TraceRecord& r)
+{
+    return r.opcode < static_cast<std::uint8_t>(Opcode::Count) && validOperand(r.dstKind, r.dst)
+        && validOperand(r.srcKind, r.src) && validOperand(r.changedKind, r.changed);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        std::cerr << "Usage: cpu_trace_dump trace.bin\n";
+        return 1;
+    }
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    if (!Tracer::read(argv[1], header, records)) {
+        std::cerr << "Not a trace file: " << argv[1] << '\n';
+        return 1;
+    }
+
+    std::uint64_t sequence = header.firstSequence;
+    for (const TraceRecord& r : records) {
+        if (!validRecord(r)) {
+            std::cout.flush();
+            std::cerr << "corrupt record at " << sequence << '\n';
+            return 1;
+        }
+        std::cout << '#' << sequence++ << " [" << r.address << "] " << opcodeNames[r.opcode] << ' ';
+        printOperand(std::cout, r.dstKind, r.dst);
+        if (static_cast<OperandKind>(r.srcKind) != OperandKind::None) {
+            std::cout << " , ";
+            printOperand(std::cout, r.srcKind, r.src);
+        }
+        if (static_cast<OperandKind>(r.changedKind) != OperandKind::None) {
+            std::cout << "  -> ";
+            printOperand(std::cout, r.changedKind, r.changed);
+            std::cout << " = " << r.value;
+        }
+        std::cout << '\n';
+    }
+    return 0;
+}